@@ -73,13 +73,13 @@
 /* global variables */
 
 /* XXX: get rid of this ASAP (or maybe not) */
-ST_DATA struct TCCState *tcc_state;
-#if CONFIG_TCC_SEMLOCK
+ST_DATA ST_TLS struct TCCState *tcc_state;
+#if CONFIG_TCC_SEMLOCK && !CONFIG_TCC_THREADS
 static TCCSem tcc_compile_sem;
 #endif
 /* an array of pointers to memory to be free'd after errors */
-ST_DATA void** stk_data;
-ST_DATA int nb_stk_data;
+ST_DATA ST_TLS void** stk_data;
+ST_DATA ST_TLS int nb_stk_data;
 
 /********************************************************/
 #ifdef _WIN32
@@ -135,7 +135,9 @@ PUB_FUNC void tcc_enter_state(TCCState *s1)
 {
     if (s1->error_set_jmp_enabled)
         return;
+#if !CONFIG_TCC_THREADS
     WAIT_SEM(&tcc_compile_sem);
+#endif
     tcc_state = s1;
 }
 
@@ -144,7 +146,9 @@ PUB_FUNC void tcc_exit_state(TCCState *s1)
     if (s1->error_set_jmp_enabled)
         return;
     tcc_state = NULL;
+#if !CONFIG_TCC_THREADS
     POST_SEM(&tcc_compile_sem);
+#endif
 }
 
 /********************************************************/
@@ -711,9 +715,9 @@ ST_FUNC void tcc_close(void)
     tcc_free(bf);
 }
 
-static int tcc_open_memfd(TCCState *s1, const char *filename, const char *data, int size)
+ST_FUNC int tcc_open_memfd(TCCState *s1, const char *filename, const char *data, int size)
 {
-    int fd = memfd_create(filename, 0);
+    int fd = memfd_create(filename, MFD_CLOEXEC);
     if (fd < 0) {
         char template[] = "/tmp/tcc-XXXXXX";
         fd = mkstemp(template);
@@ -721,6 +725,8 @@ static int tcc_open_memfd(TCCState *s1, const char *filename, const char *data,
             tcc_error_noabort("could not create temporary file");
             exit(1);
         }
+        unlink(template);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
     }
     do {
         int ret = write(fd, data, size);
@@ -736,15 +742,11 @@ static int tcc_open_memfd(TCCState *s1, const char *filename, const char *data,
     return fd;
 }
 
-extern const char *libtcc1a;
-extern const int libtcc1a_len;
-
 static int _tcc_open(TCCState *s1, const char *filename)
 {
     int fd;
-    if (libtcc1a && strstr(filename, "libtcc1.a")) {
-        return tcc_open_memfd(s1, "libtcc1a", libtcc1a, libtcc1a_len);
-    }
+    if (strstr(filename, "libtcc1.a") && (fd = tcc_open_libtcc1a(s1)) >= 0)
+        return fd;
     if (strcmp(filename, "-") == 0)
         fd = 0, filename = "<stdin>";
     else
@@ -1064,6 +1066,8 @@ ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
 
         obj_type = tcc_object_type(fd, &ehdr);
         lseek(fd, 0, SEEK_SET);
+        if (obj_type == AFF_BINTYPE_REL || obj_type == AFF_BINTYPE_AR)
+            tcc_map_file(s1, fd);
 
         switch (obj_type) {
 
@@ -1143,6 +1147,7 @@ check_success:
             break;
 #endif
         }
+        tcc_unmap_file(s1);
         close(fd);
     } else {
         /* update target deps */
@@ -1553,6 +1558,7 @@ enum {
     TCC_OPTION_B,
     TCC_OPTION_l,
     TCC_OPTION_bench,
+    TCC_OPTION_j,
     TCC_OPTION_bt,
     TCC_OPTION_b,
     TCC_OPTION_ba,
@@ -1620,6 +1626,7 @@ static const TCCOption tcc_options[] = {
     { "B", TCC_OPTION_B, TCC_OPTION_HAS_ARG },
     { "l", TCC_OPTION_l, TCC_OPTION_HAS_ARG },
     { "bench", TCC_OPTION_bench, 0 },
+    { "j", TCC_OPTION_j, TCC_OPTION_HAS_ARG },
 #ifdef CONFIG_TCC_BACKTRACE
     { "bt", TCC_OPTION_bt, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
 #endif
@@ -1973,6 +1980,11 @@ dorun:
         case TCC_OPTION_bench:
             s->do_bench = 1;
             break;
+        case TCC_OPTION_j:
+            s->nb_jobs = atoi(optarg);
+            if (s->nb_jobs < 1)
+                return tcc_error_noabort("invalid argument to '%s'", r);
+            break;
 #ifdef CONFIG_TCC_BACKTRACE
         case TCC_OPTION_bt:
             s->rt_num_callers = atoi(optarg); /* zero = default (6) */
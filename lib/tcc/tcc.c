@@ -28,8 +28,10 @@
 #endif
 #include "tcctools.c"
 
-const char *libtcc1a = NULL;
-const int libtcc1a_len = 0;
+int tcc_open_libtcc1a(TCCState *s1)
+{
+    return -1;
+}
 
 static const char help[] =
     "Tiny C Compiler "TCC_VERSION" - Copyright (C) 2001-2006 Fabrice Bellard\n"
@@ -389,6 +389,22 @@ extern long double strtold (const char *__nptr, char **__endptr);
 # define CONFIG_TCC_SEMLOCK 1
 #endif
 
+/* keep the parser and code generator state in thread-local storage, so
+   that separate TCCStates can compile concurrently instead of taking turns
+   under the compile semaphore */
+#ifndef CONFIG_TCC_THREADS
+# if defined __GNUC__ && !defined __TINYC__
+#  define CONFIG_TCC_THREADS 1
+# else
+#  define CONFIG_TCC_THREADS 0
+# endif
+#endif
+#if CONFIG_TCC_THREADS
+# define ST_TLS __thread
+#else
+# define ST_TLS
+#endif
+
 #if ONE_SOURCE
 #define ST_INLN static inline
 #define ST_FUNC static
@@ -802,6 +818,7 @@ struct TCCState {
     unsigned char gen_deps; /* option -MD  */
     unsigned char include_sys_deps; /* option -MD  */
     unsigned char gen_phony_deps; /* option -MP */
+    int nb_jobs; /* option -j: parallel -c compiles, 0 for one per CPU */
 
     /* compile with debug symbol (and use them if error during execution) */
     unsigned char do_debug;
@@ -1027,6 +1044,11 @@ struct TCCState {
     /* used by tcc_load_ldscript */
     int fd, cc;
 
+    /* .o or .a input mapped by tcc_map_file */
+    unsigned char *ld_map;
+    unsigned long ld_map_size;
+    int ld_map_fd;
+
     /* for warnings/errors for object files */
     const char *current_filename;
 
@@ -1224,9 +1246,9 @@ enum tcc_token {
 
 /* ------------ libtcc.c ------------ */
 
-ST_DATA struct TCCState *tcc_state;
-ST_DATA void** stk_data;
-ST_DATA int nb_stk_data;
+ST_DATA ST_TLS struct TCCState *tcc_state;
+ST_DATA ST_TLS void** stk_data;
+ST_DATA ST_TLS int nb_stk_data;
 
 /* public functions currently used by the tcc main function */
 ST_FUNC char *pstrcpy(char *buf, size_t buf_size, const char *s);
@@ -1281,6 +1303,9 @@ ST_FUNC void cstr_reset(CString *cstr);
 ST_FUNC void tcc_open_bf(TCCState *s1, const char *filename, int initlen);
 ST_FUNC int tcc_open(TCCState *s1, const char *filename);
 ST_FUNC void tcc_close(void);
+ST_FUNC int tcc_open_memfd(TCCState *s1, const char *filename, const char *data, int size);
+/* provided by the driver: return an fd for the builtin libtcc1.a, or -1 */
+int tcc_open_libtcc1a(TCCState *s1);
 
 /* mark a memory pointer on stack for cleanup after errors */
 #define stk_push(p) dynarray_add(&stk_data, &nb_stk_data, p)
@@ -1346,18 +1371,18 @@ ST_FUNC int normalized_PATHCMP(const char *f1, const char *f2);
 
 /* ------------ tccpp.c ------------ */
 
-ST_DATA struct BufferedFile *file;
-ST_DATA int tok;
-ST_DATA CValue tokc;
-ST_DATA const int *macro_ptr;
-ST_DATA int parse_flags;
-ST_DATA int tok_flags;
-ST_DATA CString tokcstr; /* current parsed string, if any */
+ST_DATA ST_TLS struct BufferedFile *file;
+ST_DATA ST_TLS int tok;
+ST_DATA ST_TLS CValue tokc;
+ST_DATA ST_TLS const int *macro_ptr;
+ST_DATA ST_TLS int parse_flags;
+ST_DATA ST_TLS int tok_flags;
+ST_DATA ST_TLS CString tokcstr; /* current parsed string, if any */
 
 /* display benchmark infos */
-ST_DATA int tok_ident;
-ST_DATA TokenSym **table_ident;
-ST_DATA int pp_expr;
+ST_DATA ST_TLS int tok_ident;
+ST_DATA ST_TLS TokenSym **table_ident;
+ST_DATA ST_TLS int pp_expr;
 
 #define TOK_FLAG_BOL   0x0001 /* beginning of line before */
 #define TOK_FLAG_BOF   0x0002 /* beginning of file before */
@@ -1436,23 +1461,23 @@ static inline int toup(int c) {
 
 #define SYM_POOL_NB (8192 / sizeof(Sym))
 
-ST_DATA Sym *global_stack;
-ST_DATA Sym *local_stack;
-ST_DATA Sym *local_label_stack;
-ST_DATA Sym *global_label_stack;
-ST_DATA Sym *define_stack;
-ST_DATA CType int_type, func_old_type, char_pointer_type;
-ST_DATA SValue *vtop;
-ST_DATA int rsym, anon_sym, ind, loc;
-ST_DATA char debug_modes;
-
-ST_DATA int nocode_wanted; /* true if no code generation wanted for an expression */
-ST_DATA int global_expr;  /* true if compound literals must be allocated globally (used during initializers parsing */
-ST_DATA CType func_vt; /* current function return type (used by return instruction) */
-ST_DATA int func_var; /* true if current function is variadic */
-ST_DATA int func_vc;
-ST_DATA int func_ind;
-ST_DATA const char *funcname;
+ST_DATA ST_TLS Sym *global_stack;
+ST_DATA ST_TLS Sym *local_stack;
+ST_DATA ST_TLS Sym *local_label_stack;
+ST_DATA ST_TLS Sym *global_label_stack;
+ST_DATA ST_TLS Sym *define_stack;
+ST_DATA ST_TLS CType int_type, func_old_type, char_pointer_type;
+ST_DATA ST_TLS SValue *vtop;
+ST_DATA ST_TLS int rsym, anon_sym, ind, loc;
+ST_DATA ST_TLS char debug_modes;
+
+ST_DATA ST_TLS int nocode_wanted; /* true if no code generation wanted for an expression */
+ST_DATA ST_TLS int global_expr;  /* true if compound literals must be allocated globally (used during initializers parsing */
+ST_DATA ST_TLS CType func_vt; /* current function return type (used by return instruction) */
+ST_DATA ST_TLS int func_var; /* true if current function is variadic */
+ST_DATA ST_TLS int func_vc;
+ST_DATA ST_TLS int func_ind;
+ST_DATA ST_TLS const char *funcname;
 
 ST_FUNC void tccgen_init(TCCState *s1);
 ST_FUNC int tccgen_compile(TCCState *s1);
@@ -1530,7 +1555,7 @@ ST_FUNC int classify_x86_64_va_arg(CType *ty);
 #endif
 #ifdef CONFIG_TCC_BCHECK
 ST_FUNC void gbound_args(int nb_args);
-ST_DATA int func_bound_add_epilog;
+ST_DATA ST_TLS int func_bound_add_epilog;
 #endif
 
 /* ------------ tccelf.c ------------ */
@@ -1577,6 +1602,8 @@ ST_FUNC void relocate_sections(TCCState *s1);
 ST_FUNC ssize_t full_read(int fd, void *buf, size_t count);
 ST_FUNC void *load_data(int fd, unsigned long file_offset, unsigned long size);
 ST_FUNC int tcc_object_type(int fd, ElfW(Ehdr) *h);
+ST_FUNC void tcc_map_file(TCCState *s1, int fd);
+ST_FUNC void tcc_unmap_file(TCCState *s1);
 ST_FUNC int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset);
 ST_FUNC int tcc_load_archive(TCCState *s1, int fd, int alacarte);
 ST_FUNC void add_array(TCCState *s1, const char *sec, int c);
@@ -23,6 +23,10 @@
  */
 
 #include "tcc.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /* Define this to get some debug output during relocation processing.  */
 #undef DEBUG_RELOC
@@ -3050,6 +3054,76 @@ ST_FUNC void *load_data(int fd, unsigned long file_offset, unsigned long size)
     return data;
 }
 
+/* map a .o or .a input, so that its contents are read in place */
+ST_FUNC void tcc_map_file(TCCState *s1, int fd)
+{
+#ifndef _WIN32
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size)
+        return;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    s1->ld_map = map;
+    s1->ld_map_size = st.st_size;
+    s1->ld_map_fd = fd;
+#endif
+}
+
+ST_FUNC void tcc_unmap_file(TCCState *s1)
+{
+#ifndef _WIN32
+    if (s1->ld_map)
+        munmap(s1->ld_map, s1->ld_map_size);
+#endif
+    s1->ld_map = NULL;
+}
+
+static int is_mapped(TCCState *s1, int fd, unsigned long file_offset,
+                     unsigned long size)
+{
+    return s1->ld_map && fd == s1->ld_map_fd
+        && file_offset <= s1->ld_map_size
+        && size <= s1->ld_map_size - file_offset;
+}
+
+/* like lseek + full_read, but copying straight from the mapping */
+static ssize_t read_data(TCCState *s1, int fd, unsigned long file_offset,
+                         void *buf, unsigned long size)
+{
+    if (s1->ld_map && fd == s1->ld_map_fd) {
+        if (file_offset > s1->ld_map_size)
+            return 0;
+        if (size > s1->ld_map_size - file_offset)
+            size = s1->ld_map_size - file_offset;
+        if (size)
+            memcpy(buf, s1->ld_map + file_offset, size);
+        return size;
+    }
+    lseek(fd, file_offset, SEEK_SET);
+    return full_read(fd, buf, size);
+}
+
+/* like load_data, but points into the mapping if there is one.  Archive
+   members are only 2-byte aligned, so misaligned data is copied. */
+static void *map_data(TCCState *s1, int fd, unsigned long file_offset,
+                      unsigned long size)
+{
+    if (is_mapped(s1, fd, file_offset, size)
+        && 0 == (file_offset & (sizeof(ElfW(Addr)) - 1)))
+        return s1->ld_map + file_offset;
+    return load_data(fd, file_offset, size);
+}
+
+static void unmap_data(TCCState *s1, void *data)
+{
+    unsigned char *p = data;
+    if (!s1->ld_map || p < s1->ld_map || p >= s1->ld_map + s1->ld_map_size)
+        tcc_free(data);
+}
+
 typedef struct SectionMergeInfo {
     Section *s;            /* corresponding existing section */
     unsigned long offset;  /* offset of the new section in the existing section */
@@ -3057,9 +3131,8 @@ typedef struct SectionMergeInfo {
     uint8_t link_once;         /* true if link once section */
 } SectionMergeInfo;
 
-ST_FUNC int tcc_object_type(int fd, ElfW(Ehdr) *h)
+static int object_type(ElfW(Ehdr) *h, int size)
 {
-    int size = full_read(fd, h, sizeof *h);
     if (size == sizeof *h && 0 == memcmp(h, ELFMAG, 4)) {
         if (h->e_type == ET_REL)
             return AFF_BINTYPE_REL;
@@ -3076,6 +3149,11 @@ ST_FUNC int tcc_object_type(int fd, ElfW(Ehdr) *h)
     return 0;
 }
 
+ST_FUNC int tcc_object_type(int fd, ElfW(Ehdr) *h)
+{
+    return object_type(h, full_read(fd, h, sizeof *h));
+}
+
 /* load an object file and merge it with current files */
 /* XXX: handle correctly stab (debug) info */
 ST_FUNC int tcc_load_object_file(TCCState *s1,
@@ -3084,7 +3162,8 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
     ElfW(Ehdr) ehdr;
     ElfW(Shdr) *shdr, *sh;
     unsigned long size, offset, offseti;
-    int i, j, nb_syms, sym_index, ret, seencompressed;
+    int i, j, nb_syms, sym_index, ret, seencompressed, shndx;
+    addr_t value, align;
     char *strsec, *strtab;
     int stab_index, stabstr_index;
     int *old_to_new_syms;
@@ -3094,8 +3173,8 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
     ElfW_Rel *rel;
     Section *s;
 
-    lseek(fd, file_offset, SEEK_SET);
-    if (tcc_object_type(fd, &ehdr) != AFF_BINTYPE_REL)
+    if (object_type(&ehdr, read_data(s1, fd, file_offset, &ehdr, sizeof ehdr))
+        != AFF_BINTYPE_REL)
         goto invalid;
     /* test CPU specific stuff */
     if (ehdr.e_ident[5] != ELFDATA2LSB ||
@@ -3104,13 +3183,13 @@ invalid:
         return tcc_error_noabort("invalid object file");
     }
     /* read sections */
-    shdr = load_data(fd, file_offset + ehdr.e_shoff,
+    shdr = map_data(s1, fd, file_offset + ehdr.e_shoff,
                      sizeof(ElfW(Shdr)) * ehdr.e_shnum);
     sm_table = tcc_mallocz(sizeof(SectionMergeInfo) * ehdr.e_shnum);
 
     /* load section names */
     sh = &shdr[ehdr.e_shstrndx];
-    strsec = load_data(fd, file_offset + sh->sh_offset, sh->sh_size);
+    strsec = map_data(s1, fd, file_offset + sh->sh_offset, sh->sh_size);
 
     /* load symtab and strtab */
     old_to_new_syms = NULL;
@@ -3129,12 +3208,12 @@ invalid:
                 goto the_end;
             }
             nb_syms = sh->sh_size / sizeof(ElfW(Sym));
-            symtab = load_data(fd, file_offset + sh->sh_offset, sh->sh_size);
+            symtab = map_data(s1, fd, file_offset + sh->sh_offset, sh->sh_size);
             sm_table[i].s = symtab_section;
 
             /* now load strtab */
             sh = &shdr[sh->sh_link];
-            strtab = load_data(fd, file_offset + sh->sh_offset, sh->sh_size);
+            strtab = map_data(s1, fd, file_offset + sh->sh_offset, sh->sh_size);
         }
 	if (sh->sh_flags & SHF_COMPRESSED)
 	    seencompressed = 1;
@@ -3170,8 +3249,7 @@ invalid:
 
 	sh = &shdr[i];
         sh_name = strsec + sh->sh_name;
-        if (sh->sh_addralign < 1)
-            sh->sh_addralign = 1;
+        align = sh->sh_addralign < 1 ? 1 : sh->sh_addralign;
         /* find corresponding section, if any */
         for(j = 1; j < s1->nb_sections;j++) {
             s = s1->sections[j];
@@ -3198,7 +3276,7 @@ invalid:
         s = new_section(s1, sh_name, sh->sh_type, sh->sh_flags & ~SHF_GROUP);
         /* take as much info as possible from the section. sh_link and
            sh_info will be updated later */
-        s->sh_addralign = sh->sh_addralign;
+        s->sh_addralign = align;
         s->sh_entsize = sh->sh_entsize;
         sm_table[i].new_section = 1;
     found:
@@ -3211,18 +3289,17 @@ invalid:
             goto the_end;
         }
         /* align start of section */
-        s->data_offset += -s->data_offset & (sh->sh_addralign - 1);
-        if (sh->sh_addralign > s->sh_addralign)
-            s->sh_addralign = sh->sh_addralign;
+        s->data_offset += -s->data_offset & (align - 1);
+        if (align > s->sh_addralign)
+            s->sh_addralign = align;
         sm_table[i].offset = s->data_offset;
         sm_table[i].s = s;
         /* concatenate sections */
         size = sh->sh_size;
         if (sh->sh_type != SHT_NOBITS) {
             unsigned char *ptr;
-            lseek(fd, file_offset + sh->sh_offset, SEEK_SET);
             ptr = section_ptr_add(s, size);
-            full_read(fd, ptr, size);
+            read_data(s1, fd, file_offset + sh->sh_offset, ptr, size);
         } else {
             s->data_offset += size;
         }
@@ -3265,8 +3342,9 @@ invalid:
 
     sym = symtab + 1;
     for(i = 1; i < nb_syms; i++, sym++) {
-        if (sym->st_shndx != SHN_UNDEF &&
-            sym->st_shndx < SHN_LORESERVE) {
+        shndx = sym->st_shndx;
+        value = sym->st_value;
+        if (shndx != SHN_UNDEF && shndx < SHN_LORESERVE) {
             sm = &sm_table[sym->st_shndx];
             if (sm->link_once) {
                 /* if a symbol is in a link once section, we use the
@@ -3284,15 +3362,14 @@ invalid:
             if (!sm->s)
                 continue;
             /* convert section number */
-            sym->st_shndx = sm->s->sh_num;
+            shndx = sm->s->sh_num;
             /* offset value */
-            sym->st_value += sm->offset;
+            value += sm->offset;
         }
         /* add symbol */
         name = strtab + sym->st_name;
-        sym_index = set_elf_sym(symtab_section, sym->st_value, sym->st_size,
-                                sym->st_info, sym->st_other,
-                                sym->st_shndx, name);
+        sym_index = set_elf_sym(symtab_section, value, sym->st_size,
+                                sym->st_info, sym->st_other, shndx, name);
         old_to_new_syms[i] = sym_index;
     }
 
@@ -3358,12 +3435,12 @@ invalid:
 
     ret = 0;
  the_end:
-    tcc_free(symtab);
-    tcc_free(strtab);
+    unmap_data(s1, symtab);
+    unmap_data(s1, strtab);
     tcc_free(old_to_new_syms);
     tcc_free(sm_table);
-    tcc_free(strsec);
-    tcc_free(shdr);
+    unmap_data(s1, strsec);
+    unmap_data(s1, shdr);
     return ret;
 }
 
@@ -3387,12 +3464,11 @@ static unsigned long long get_be(const uint8_t *b, int n)
     return ret;
 }
 
-static int read_ar_header(int fd, int offset, ArchiveHeader *hdr)
+static int read_ar_header(TCCState *s1, int fd, int offset, ArchiveHeader *hdr)
 {
     char *p, *e;
     int len;
-    lseek(fd, offset, SEEK_SET);
-    len = full_read(fd, hdr, sizeof(ArchiveHeader));
+    len = read_data(s1, fd, offset, hdr, sizeof(ArchiveHeader));
     if (len != sizeof(ArchiveHeader))
         return len ? -1 : 0;
     p = hdr->ar_name;
@@ -3404,50 +3480,73 @@ static int read_ar_header(int fd, int offset, ArchiveHeader *hdr)
 }
 
 /* load only the objects which resolve undefined symbols */
-static int tcc_load_alacarte(TCCState *s1, int fd, int size, int entrysize)
+static int tcc_load_alacarte(TCCState *s1, int fd, unsigned long file_offset,
+                             int size, int entrysize)
 {
-    int i, bound, nsyms, sym_index, len, ret = -1;
+    int i, h, nsyms, nbuckets, sym_index, len, ret = -1;
+    int *buckets = NULL;
     unsigned long long off;
     uint8_t *data;
-    const char *ar_names, *p;
+    const char *ar_names, *p, **names = NULL;
     const uint8_t *ar_index;
     ElfW(Sym) *sym;
     ArchiveHeader hdr;
 
-    data = tcc_malloc(size);
-    if (full_read(fd, data, size) != size)
+    if (is_mapped(s1, fd, file_offset, size))
+        data = s1->ld_map + file_offset;
+    else if (read_data(s1, fd, file_offset, data = tcc_malloc(size), size) != size)
         goto the_end;
     nsyms = get_be(data, entrysize);
     ar_index = data + entrysize;
     ar_names = (char *) ar_index + nsyms * entrysize;
 
-    do {
-        bound = 0;
-        for (p = ar_names, i = 0; i < nsyms; i++, p += strlen(p)+1) {
-            Section *s = symtab_section;
-            sym_index = find_elf_sym(s, p);
-            if (!sym_index)
-                continue;
-            sym = &((ElfW(Sym) *)s->data)[sym_index];
-            if(sym->st_shndx != SHN_UNDEF)
-                continue;
-            off = get_be(ar_index + i * entrysize, entrysize);
-            len = read_ar_header(fd, off, &hdr);
-            if (len <= 0 || memcmp(hdr.ar_fmag, ARFMAG, 2)) {
-                tcc_error_noabort("invalid archive");
-                goto the_end;
-            }
-            off += len;
-            if (s1->verbose == 2)
-                printf("   -> %s\n", hdr.ar_name);
-            if (tcc_load_object_file(s1, fd, off) < 0)
-                goto the_end;
-            ++bound;
+    /* hash the index once, keeping the first member defining each name */
+    for (nbuckets = 16; nbuckets < 2 * nsyms; nbuckets *= 2)
+        ;
+    buckets = tcc_mallocz(nbuckets * sizeof *buckets);
+    names = tcc_malloc(nsyms * sizeof *names);
+    for (p = ar_names, i = 0; i < nsyms; i++, p += strlen(p)+1) {
+        names[i] = p;
+        h = elf_hash((unsigned char *) p) & (nbuckets - 1);
+        while (buckets[h] && strcmp(p, names[buckets[h] - 1]))
+            h = (h + 1) & (nbuckets - 1);
+        if (!buckets[h])
+            buckets[h] = i + 1;
+    }
+
+    /* walk the symbol table, which grows as objects get loaded, so that
+       undefined symbols of pulled in objects are resolved in turn */
+    for (sym_index = 1;
+         sym_index < symtab_section->data_offset / sizeof(ElfW(Sym));
+         sym_index++) {
+        sym = &((ElfW(Sym) *)symtab_section->data)[sym_index];
+        if (sym->st_shndx != SHN_UNDEF
+            || ELFW(ST_BIND)(sym->st_info) == STB_LOCAL)
+            continue;
+        p = (char *) symtab_section->link->data + sym->st_name;
+        h = elf_hash((unsigned char *) p) & (nbuckets - 1);
+        while (buckets[h] && strcmp(p, names[buckets[h] - 1]))
+            h = (h + 1) & (nbuckets - 1);
+        if (!buckets[h])
+            continue;
+        i = buckets[h] - 1;
+        off = get_be(ar_index + i * entrysize, entrysize);
+        len = read_ar_header(s1, fd, off, &hdr);
+        if (len <= 0 || memcmp(hdr.ar_fmag, ARFMAG, 2)) {
+            tcc_error_noabort("invalid archive");
+            goto the_end;
         }
-    } while(bound);
+        off += len;
+        if (s1->verbose == 2)
+            printf("   -> %s\n", hdr.ar_name);
+        if (tcc_load_object_file(s1, fd, off) < 0)
+            goto the_end;
+    }
     ret = 0;
  the_end:
-    tcc_free(data);
+    tcc_free(names);
+    tcc_free(buckets);
+    unmap_data(s1, data);
     return ret;
 }
 
@@ -3465,7 +3564,7 @@ ST_FUNC int tcc_load_archive(TCCState *s1, int fd, int alacarte)
     file_offset = sizeof ARMAG - 1;
 
     for(;;) {
-        len = read_ar_header(fd, file_offset, &hdr);
+        len = read_ar_header(s1, fd, file_offset, &hdr);
         if (len == 0)
             return 0;
         if (len < 0)
@@ -3477,10 +3576,11 @@ ST_FUNC int tcc_load_archive(TCCState *s1, int fd, int alacarte)
         if (alacarte) {
             /* coff symbol table : we handle it */
             if (!strcmp(hdr.ar_name, "/"))
-                return tcc_load_alacarte(s1, fd, size, 4);
+                return tcc_load_alacarte(s1, fd, file_offset, size, 4);
             if (!strcmp(hdr.ar_name, "/SYM64/"))
-                return tcc_load_alacarte(s1, fd, size, 8);
-        } else if (tcc_object_type(fd, &ehdr) == AFF_BINTYPE_REL) {
+                return tcc_load_alacarte(s1, fd, file_offset, size, 8);
+        } else if (object_type(&ehdr, read_data(s1, fd, file_offset, &ehdr,
+                   sizeof ehdr)) == AFF_BINTYPE_REL) {
             if (s1->verbose == 2)
                 printf("   -> %s\n", hdr.ar_name);
             if (tcc_load_object_file(s1, fd, file_offset) < 0)
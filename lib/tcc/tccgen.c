@@ -33,27 +33,27 @@
    rsym: return symbol
    anon_sym: anonymous symbol index
 */
-ST_DATA int rsym, anon_sym, ind, loc;
+ST_DATA ST_TLS int rsym, anon_sym, ind, loc;
 
-ST_DATA Sym *global_stack;
-ST_DATA Sym *local_stack;
-ST_DATA Sym *define_stack;
-ST_DATA Sym *global_label_stack;
-ST_DATA Sym *local_label_stack;
+ST_DATA ST_TLS Sym *global_stack;
+ST_DATA ST_TLS Sym *local_stack;
+ST_DATA ST_TLS Sym *define_stack;
+ST_DATA ST_TLS Sym *global_label_stack;
+ST_DATA ST_TLS Sym *local_label_stack;
 
-static Sym *sym_free_first;
-static void **sym_pools;
-static int nb_sym_pools;
+static ST_TLS Sym *sym_free_first;
+static ST_TLS void **sym_pools;
+static ST_TLS int nb_sym_pools;
 
-static Sym *all_cleanups, *pending_gotos;
-static int local_scope;
-ST_DATA char debug_modes;
+static ST_TLS Sym *all_cleanups, *pending_gotos;
+static ST_TLS int local_scope;
+ST_DATA ST_TLS char debug_modes;
 
-ST_DATA SValue *vtop;
-static SValue _vstack[1 + VSTACK_SIZE];
+ST_DATA ST_TLS SValue *vtop;
+static ST_TLS SValue *_vstack;
 #define vstack (_vstack + 1)
 
-ST_DATA int nocode_wanted; /* no code generation wanted */
+ST_DATA ST_TLS int nocode_wanted; /* no code generation wanted */
 #define NODATA_WANTED (nocode_wanted > 0) /* no static data output wanted either */
 #define DATA_ONLY_WANTED 0x80000000 /* ON outside of functions and for static initializers */
 
@@ -71,14 +71,14 @@ ST_DATA int nocode_wanted; /* no code generation wanted */
 #define CONST_WANTED_MASK 0x0FFF0000
 #define CONST_WANTED  (nocode_wanted & CONST_WANTED_MASK)
 
-ST_DATA int global_expr;  /* true if compound literals must be allocated globally (used during initializers parsing */
-ST_DATA CType func_vt; /* current function return type (used by return instruction) */
-ST_DATA int func_var; /* true if current function is variadic (used by return instruction) */
-ST_DATA int func_vc;
-ST_DATA int func_ind;
-ST_DATA const char *funcname;
-ST_DATA CType int_type, func_old_type, char_type, char_pointer_type;
-static CString initstr;
+ST_DATA ST_TLS int global_expr;  /* true if compound literals must be allocated globally (used during initializers parsing */
+ST_DATA ST_TLS CType func_vt; /* current function return type (used by return instruction) */
+ST_DATA ST_TLS int func_var; /* true if current function is variadic (used by return instruction) */
+ST_DATA ST_TLS int func_vc;
+ST_DATA ST_TLS int func_ind;
+ST_DATA ST_TLS const char *funcname;
+ST_DATA ST_TLS CType int_type, func_old_type, char_type, char_pointer_type;
+static ST_TLS CString initstr;
 
 #if PTR_SIZE == 4
 #define VT_SIZE_T (VT_INT | VT_UNSIGNED)
@@ -91,7 +91,7 @@ static CString initstr;
 #define VT_PTRDIFF_T (VT_LONG | VT_LLONG)
 #endif
 
-static struct switch_t {
+static ST_TLS struct switch_t {
     struct case_t {
         int64_t v1, v2;
 	int sym;
@@ -106,14 +106,14 @@ static struct switch_t {
 
 #define MAX_TEMP_LOCAL_VARIABLE_NUMBER 8
 /*list of temporary local variables on the stack in current function. */
-static struct temp_local_variable {
+static ST_TLS struct temp_local_variable {
 	int location; //offset on stack. Svalue.c.i
 	short size;
 	short align;
 } arr_temp_local_vars[MAX_TEMP_LOCAL_VARIABLE_NUMBER];
-static int nb_temp_local_vars;
+static ST_TLS int nb_temp_local_vars;
 
-static struct scope {
+static ST_TLS struct scope {
     struct scope *prev;
     struct { int loc, locorig, num; } vla;
     struct { Sym *s; int n; } cl;
@@ -130,6 +130,7 @@ typedef struct {
 #if 1
 #define precedence_parser
 static void init_prec(void);
+static ST_TLS unsigned char *prec;
 #endif
 
 static void block(int flags);
@@ -362,6 +363,7 @@ void pv (const char *lbl, int a, int b)
 /* initialize vstack and types.  This must be done also for tcc -E */
 ST_FUNC void tccgen_init(TCCState *s1)
 {
+    _vstack = tcc_malloc((1 + VSTACK_SIZE) * sizeof(SValue));
     vtop = vstack - 1;
     memset(vtop, 0, sizeof *vtop);
 
@@ -379,6 +381,7 @@ ST_FUNC void tccgen_init(TCCState *s1)
     func_old_type.ref->f.func_call = FUNC_CDECL;
     func_old_type.ref->f.func_type = FUNC_OLD;
 #ifdef precedence_parser
+    prec = tcc_malloc(256);
     init_prec();
 #endif
     cstr_new(&initstr);
@@ -434,6 +437,12 @@ ST_FUNC void tccgen_finish(TCCState *s1)
     local_label_stack = NULL;
     cur_text_section = NULL;
     sym_free_first = NULL;
+    tcc_free(_vstack);
+    _vstack = vtop = NULL;
+#ifdef precedence_parser
+    tcc_free(prec);
+    prec = NULL;
+#endif
 }
 
 /* ------------------------------------------------------------------------- */
@@ -6329,7 +6338,6 @@ static int precedence(int tok)
 	    return 0;
     }
 }
-static unsigned char prec[256];
 static void init_prec(void)
 {
     int i;
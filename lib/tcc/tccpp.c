@@ -31,37 +31,37 @@
 /********************************************************/
 /* global variables */
 
-ST_DATA int tok_flags;
-ST_DATA int parse_flags;
+ST_DATA ST_TLS int tok_flags;
+ST_DATA ST_TLS int parse_flags;
 
-ST_DATA struct BufferedFile *file;
-ST_DATA int tok;
-ST_DATA CValue tokc;
-ST_DATA const int *macro_ptr;
-ST_DATA CString tokcstr; /* current parsed string, if any */
+ST_DATA ST_TLS struct BufferedFile *file;
+ST_DATA ST_TLS int tok;
+ST_DATA ST_TLS CValue tokc;
+ST_DATA ST_TLS const int *macro_ptr;
+ST_DATA ST_TLS CString tokcstr; /* current parsed string, if any */
 
 /* display benchmark infos */
-ST_DATA int tok_ident;
-ST_DATA TokenSym **table_ident;
-ST_DATA int pp_expr;
+ST_DATA ST_TLS int tok_ident;
+ST_DATA ST_TLS TokenSym **table_ident;
+ST_DATA ST_TLS int pp_expr;
 
 /* ------------------------------------------------------------------------- */
 
-static TokenSym *hash_ident[TOK_HASH_SIZE];
-static char token_buf[STRING_MAX_SIZE + 1];
-static CString cstr_buf;
-static TokenString tokstr_buf;
-static TokenString unget_buf;
-static unsigned char isidnum_table[256 - CH_EOF];
-static int pp_debug_tok, pp_debug_symv;
-static int pp_counter;
+static ST_TLS TokenSym **hash_ident;
+static ST_TLS char *token_buf;
+static ST_TLS CString cstr_buf;
+static ST_TLS TokenString tokstr_buf;
+static ST_TLS TokenString unget_buf;
+static ST_TLS unsigned char isidnum_table[256 - CH_EOF];
+static ST_TLS int pp_debug_tok, pp_debug_symv;
+static ST_TLS int pp_counter;
 static void tok_print(const int *str, const char *msg, ...);
 static void next_nomacro(void);
 
-static struct TinyAlloc *toksym_alloc;
-static struct TinyAlloc *tokstr_alloc;
+static ST_TLS struct TinyAlloc *toksym_alloc;
+static ST_TLS struct TinyAlloc *tokstr_alloc;
 
-static TokenString *macro_stack;
+static ST_TLS TokenString *macro_stack;
 
 static const char tcc_keywords[] = 
 #define DEF(id, str) str "\0"
@@ -2927,7 +2927,7 @@ keep_tok_flags:
 }
 
 #ifdef PP_DEBUG
-static int indent;
+static ST_TLS int indent;
 static void define_print(TCCState *s1, int v);
 static void pp_print(const char *msg, int v, const int *str)
 {
@@ -3674,7 +3674,8 @@ ST_FUNC void tccpp_new(TCCState *s)
     tal_new(&toksym_alloc, TOKSYM_TAL_LIMIT, TOKSYM_TAL_SIZE);
     tal_new(&tokstr_alloc, TOKSTR_TAL_LIMIT, TOKSTR_TAL_SIZE);
 
-    memset(hash_ident, 0, TOK_HASH_SIZE * sizeof(TokenSym *));
+    hash_ident = tcc_mallocz(TOK_HASH_SIZE * sizeof(TokenSym *));
+    token_buf = tcc_malloc(STRING_MAX_SIZE + 1);
     memset(s->cached_includes_hash, 0, sizeof s->cached_includes_hash);
 
     cstr_new(&tokcstr);
@@ -3720,6 +3721,10 @@ ST_FUNC void tccpp_delete(TCCState *s)
         tal_free(toksym_alloc, table_ident[i]);
     tcc_free(table_ident);
     table_ident = NULL;
+    tcc_free(hash_ident);
+    hash_ident = NULL;
+    tcc_free(token_buf);
+    token_buf = NULL;
 
     /* free static buffers */
     cstr_free(&tokcstr);
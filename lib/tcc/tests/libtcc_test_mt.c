@@ -60,6 +60,12 @@ void handle_error(void *opaque, const char *msg)
     fprintf(opaque, "%s\n", msg);
 }
 
+/* libtcc asks the driver for a builtin libtcc1.a; there is none here */
+int tcc_open_libtcc1a(TCCState *s1)
+{
+    return -1;
+}
+
 /* this function is called by the generated code */
 int add(int a, int b)
 {
@@ -272,6 +278,82 @@ void time_tcc(int n, const char *src)
     }
 }
 
+/* compile tests2 cases in threads, each to its own executable, then run
+   them one by one and compare with the .expect files */
+#define T2_MAX 400
+char *t2_src[T2_MAX];
+int t2_ok[T2_MAX], t2_count;
+
+void t2_name(char *buf, int n, const char *ext)
+{
+    const char *p = strrchr(t2_src[n], '/');
+    p = p ? p + 1 : t2_src[n];
+    sprintf(buf, "%.*s%s", (int)(strlen(p) - 2), p, ext);
+}
+
+TF_TYPE(thread_test_tests2, vn)
+{
+    TCCState *s;
+    FILE *f;
+    char out[300], exe[300];
+    int n, i;
+
+    for (n = (size_t)vn; n < t2_count; n += M) {
+        t2_name(out, n, ".mt-output");
+        t2_name(exe, n, ".mt-exe");
+        f = fopen(out, "w");
+        if (!f)
+            continue;
+        s = tcc_new();
+        tcc_set_error_func(s, f, handle_error);
+        parse_args(s);
+        for (i = 1; i < g_argc; ++i)
+            if (0 == strcmp(g_argv[i], "-static"))
+                tcc_set_options(s, g_argv[i]);
+        tcc_set_output_type(s, TCC_OUTPUT_EXE);
+        if (tcc_add_file(s, t2_src[n]) == 0) {
+            for (i = 1; i < g_argc; ++i)
+                if (0 == strncmp(g_argv[i], "-l", 2))
+                    tcc_add_library(s, g_argv[i] + 2);
+            t2_ok[n] = tcc_output_file(s, exe) == 0;
+        }
+        tcc_delete(s);
+        fclose(f);
+    }
+    return 0;
+}
+
+int tests2_test(void)
+{
+    char cmd[2000], name[300], dir[300];
+    const char *p;
+    int n, fails = 0;
+
+    for (n = 0; n < M; ++n)
+        create_thread(thread_test_tests2, n);
+    wait_threads(n);
+
+    for (n = 0; n < t2_count; ++n) {
+        p = strrchr(t2_src[n], '/');
+        sprintf(dir, "%.*s", p ? (int)(p - t2_src[n]) + 1 : 0, t2_src[n]);
+        t2_name(name, n, "");
+        cmd[0] = 0;
+        if (t2_ok[n])
+            sprintf(cmd, "./%s.mt-exe >>%s.mt-output 2>&1; ", name, name);
+        sprintf(cmd + strlen(cmd), "sed -e 's,%s,,g' %s.mt-output"
+            " | diff -bu %s%s.expect - >%s.mt-diff", dir, name, dir, name, name);
+        if (system(cmd) == 0) {
+            sprintf(cmd, "rm -f %s.mt-output %s.mt-exe %s.mt-diff",
+                name, name, name);
+            system(cmd);
+        } else {
+            printf(" %s", name);
+            ++fails;
+        }
+    }
+    return fails;
+}
+
 static unsigned getclock_ms(void)
 {
 #ifdef _WIN32
@@ -292,10 +374,22 @@ int main(int argc, char **argv)
     g_argv = argv;
 
     if (argc < 2) {
-        fprintf(stderr, "usage: libtcc_test_mt tcc.c <options>\n");
+        fprintf(stderr, "usage: libtcc_test_mt tcc.c <options>\n"
+                        "       libtcc_test_mt -tests2 <options> files...\n");
         return 1;
     }
 
+    if (0 == strcmp(argv[1], "-tests2")) {
+        for (n = 2; n < argc; ++n)
+            if (argv[n][0] != '-' && t2_count < T2_MAX)
+                t2_src[t2_count++] = argv[n];
+        printf("compiling %d tests2 files in threads\n", t2_count), fflush(stdout);
+        t = getclock_ms();
+        n = tests2_test();
+        printf("%s (%u ms)\n", n ? "\n FAILED (see *.mt-diff)" : "", getclock_ms() - t);
+        return n != 0;
+    }
+
 #if 1
     printf("running fib with mixed calls\n "), fflush(stdout);
     t = getclock_ms();
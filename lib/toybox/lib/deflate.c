@@ -22,7 +22,12 @@ struct deflate {
 
 
   // Tables only used for deflation
-  unsigned short *hashhead, *hashchain;
+  unsigned short *hashhead, *hashchain, *symlit, *symdist;
+  unsigned char lensym[256], distsym[512];
+  unsigned good, nice, chain, ins, dist, nsym, extrabits;
+  unsigned litfreq[286], distfreq[30], clfreq[19];
+  unsigned short litcode[288], distcode[30], clcode[19], clen[316];
+  char bitlen[318], clbits[19];
 
   // Compressed data buffer (extra space malloced at end)
   unsigned pos, len;
@@ -327,42 +332,348 @@ static void inflate(struct deflate *dd, struct bitbuf *bb)
   if (dd->pos & 32767) inflate_out(dd, dd->pos&32767);
 }
 
-// Deflate from dd->infd to bitbuf
-// For deflate, dd->len = input read, dd->pos = input consumed
-static void deflate(struct deflate *dd, struct bitbuf *bb)
+#define DEFLATE_SYMS 16384
+
+// Compression levels 1-9: stop searching once a match is "good" long (search
+// less hard for a better one), "lazy" long (don't look for a better one
+// starting at the next byte), "nice" long (stop searching), or after "chain"
+// hash chain links. Levels 1-3 don't look ahead at the next byte at all, and
+// "lazy" is instead the longest match whose strings get added to the hash.
+static unsigned short deflate_levels[][4] = {
+  {4, 4, 8, 4}, {4, 5, 16, 8}, {4, 6, 32, 32}, {4, 4, 16, 16}, {8, 16, 32, 32},
+  {8, 16, 128, 128}, {8, 32, 128, 256}, {32, 128, 258, 1024},
+  {32, 258, 258, 4096}
+};
+
+// Generate length limited huffman code bit lengths from symbol frequencies.
+// Builds the tree by repeatedly merging the two lightest nodes (taken from
+// the sorted leaves and the internal nodes, which are created in ascending
+// weight order), and halves the frequencies to flatten it if it's too deep.
+static void freq2len(unsigned *freq, char *bitlen, int len, int limit)
 {
-  char *data = dd->data;
-  int len, final = 0;
+  unsigned short sym[288], parent[576];
+  unsigned weight[576], fr[288];
+  int i, j, n, leaf, node, max, depth[576];
 
-  dd->crc = ~0;
+  memcpy(fr, freq, len*sizeof(*fr));
+  for (n = i = 0; i<len; i++) if (fr[i]) n++;
+  // A single code (or none) can't be decoded, so always make at least two.
+  for (i = 0; n<2; i++) if (!fr[i]) fr[i] = 1, n++;
+
+  for (;;) {
+    // Insertion sort used symbols by frequency
+    for (n = i = 0; i<len; i++) {
+      if (!fr[i]) continue;
+      for (j = n++; j && fr[sym[j-1]]>fr[i]; j--) sym[j] = sym[j-1];
+      sym[j] = i;
+    }
+    for (i = 0; i<n; i++) weight[i] = fr[sym[i]];
+
+    // Merge the two lightest of the remaining leaves and internal nodes
+    for (leaf = 0, node = n, i = n; i<2*n-1; i++) {
+      for (j = 0; j<2; j++) {
+        int k = (leaf<n && (node==i || weight[leaf]<=weight[node]))
+          ? leaf++ : node++;
+
+        weight[i] = j ? weight[i]+weight[k] : weight[k];
+        parent[k] = i;
+      }
+    }
+
+    // Parents come after children, so walk down from the root
+    for (depth[2*n-2] = max = 0, i = 2*n-3; i>=0; i--)
+      if (max<(depth[i] = depth[parent[i]]+1)) max = depth[i];
+    if (max<=limit) break;
+    for (i = 0; i<len; i++) if (fr[i]) fr[i] = (fr[i]>>1)|1;
+  }
+
+  memset(bitlen, 0, len);
+  for (i = 0; i<n; i++) bitlen[sym[i]] = depth[i];
+}
+
+// Assign canonical huffman codes (see len2huff()) to array of bit lengths.
+// Huffman codes are sent most significant bit first, so store them reversed.
+static void len2code(char *bitlen, unsigned short *code, int len)
+{
+  unsigned short count[16], next[16];
+  int i, j, c;
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i<len; i++) count[bitlen[i]]++;
+  for (*count = c = 0, i = 1; i<16; i++) next[i] = c = (c+count[i-1])<<1;
+  for (i = 0; i<len; i++) {
+    if (!bitlen[i]) continue;
+    for (c = next[bitlen[i]]++, code[i] = j = 0; j<bitlen[i]; j++, c >>= 1)
+      code[i] = (code[i]<<1)|(c&1);
+  }
+}
 
-  while (!final) {
-    // Read next half-window of data if we haven't hit EOF yet.
-    len = readall(dd->infd, data+(dd->len&32768), 32768);
-    if (len < 0) perror_exit("read"); // TODO: add filename
-    if (len != 32768) final++;
-    if (dd->crcfunc) dd->crcfunc(dd, data+(dd->len&32768), len);
-    // dd->len += len;  crcfunc advances len TODO
+// Run length encode the literal and distance bit lengths (in dd->bitlen)
+// with the 0-18 code length alphabet, storing symbols in dd->clen and
+// counting them in dd->clfreq.
+static int deflate_clen(struct deflate *dd, int len)
+{
+  char *bits = dd->bitlen;
+  int i, j, run, n = 0;
+
+  memset(dd->clfreq, 0, sizeof(dd->clfreq));
+  for (i = 0; i<len; i += run) {
+    for (run = 1; i+run<len && bits[i+run]==bits[i]; run++);
+    if (!bits[i] && run>2) {
+      if (run>138) run = 138;
+      dd->clen[n++] = run>10 ? (18|((run-11)<<5)) : (17|((run-3)<<5));
+    } else if (run>3) {
+      dd->clen[n++] = bits[i];
+      if (run>7) run = 7;
+      dd->clen[n++] = 16|((run-4)<<5);
+    } else {
+      for (j = 0; j<run; j++) dd->clen[n++] = bits[i];
+    }
+  }
+  for (i = 0; i<n; i++) dd->clfreq[dd->clen[i]&31]++;
+
+  return n;
+}
+
+// Write out the block of symbols collected in dd->sym, choosing whichever
+// is smallest of a stored block, fixed huffman codes, or dynamic codes.
+static void deflate_block(struct deflate *dd, struct bitbuf *bb, char *raw,
+  int rawlen, int final)
+{
+  char *hufflen_order = "\x10\x11\x12\0\x08\x07\x09\x06\x0a\x05\x0b"
+                        "\x04\x0c\x03\x0d\x02\x0e\x01\x0f", *litlen, *distlen;
+  unsigned short *litcode, *distcode;
+  unsigned long long dyn, fix, stored;
+  int i, nlit, ndist, nclen, hclen, len;
+
+  dd->litfreq[256] = 1;
+
+  // Cost of each kind of block, in bits. (Extra bits are the same for both.)
+  stored = 8*(rawlen+4*(1+rawlen/65536))+((bb->bitpos+3+7)&~7)-bb->bitpos;
+  freq2len(dd->litfreq, litlen = dd->bitlen, 286, 15);
+  for (nlit = 286; nlit>257 && !litlen[nlit-1]; nlit--);
+  freq2len(dd->distfreq, distlen = dd->bitlen+nlit, 30, 15);
+  for (ndist = 30; ndist>1 && !distlen[ndist-1]; ndist--);
+  nclen = deflate_clen(dd, nlit+ndist);
+  freq2len(dd->clfreq, dd->clbits, 19, 7);
+  for (hclen = 19; hclen>4 && !dd->clbits[hufflen_order[hclen-1]]; hclen--);
+
+  fix = dyn = 3+dd->extrabits;
+  dyn += 14+3*hclen;
+  for (i = 0; i<19; i++) dyn += dd->clfreq[i]*dd->clbits[i];
+  for (i = 0; i<nclen; i++) dyn += "\0\0\2\3\7"[(dd->clen[i]&31)>15 ? (dd->clen[i]&31)-14 : 0];
+  for (i = 0; i<286; i++) {
+    dyn += dd->litfreq[i]*litlen[i];
+    fix += dd->litfreq[i]*(8+(i>143)-((i>255)<<1)+(i>279));
+  }
+  for (i = 0; i<30; i++) {
+    dyn += dd->distfreq[i]*distlen[i];
+    fix += dd->distfreq[i]*5;
+  }
 
-    // store block as literal
-// TODO: actually compress!
+  // Uncompressed block(s), up to 65535 bytes each
+  if (stored<=fix && stored<=dyn) {
+    do {
+      len = rawlen>65535 ? 65535 : rawlen;
+      bitbuf_put(bb, final && len==rawlen, 1);
+      bitbuf_put(bb, 0, 2);
+      bitbuf_put(bb, 0, (8-bb->bitpos)&7);
+      bitbuf_put(bb, len, 16);
+      bitbuf_put(bb, 0xffff & ~len, 16);
+      for (rawlen -= len; len--;) bitbuf_put(bb, (unsigned char)*raw++, 8);
+    } while (rawlen);
+  } else {
     bitbuf_put(bb, final, 1);
-    bitbuf_put(bb, 0, 1);
 
-    bitbuf_put(bb, 0, (8-bb->bitpos)&7);
-    bitbuf_put(bb, len, 16);
-    bitbuf_put(bb, 0xffff & ~len, 16);
+    // Fixed huffman codes
+    if (fix<=dyn) {
+      bitbuf_put(bb, 1, 2);
+      for (i = 0; i<288; i++) dd->bitlen[i] = 8+(i>143)-((i>255)<<1)+(i>279);
+      memset(dd->bitlen+288, 5, 30);
+      litlen = dd->bitlen;
+      distlen = dd->bitlen+288;
+      nlit = 288;
+      ndist = 30;
+
+    // Dynamic huffman codes: send the code lengths, then the codes
+    } else {
+      len2code(dd->clbits, dd->clcode, 19);
+      bitbuf_put(bb, 2, 2);
+      bitbuf_put(bb, nlit-257, 5);
+      bitbuf_put(bb, ndist-1, 5);
+      bitbuf_put(bb, hclen-4, 4);
+      for (i = 0; i<hclen; i++) bitbuf_put(bb, dd->clbits[hufflen_order[i]], 3);
+      for (i = 0; i<nclen; i++) {
+        int sym = dd->clen[i]&31;
+
+        bitbuf_put(bb, dd->clcode[sym], dd->clbits[sym]);
+        if (sym>15) bitbuf_put(bb, dd->clen[i]>>5, "\2\3\7"[sym-16]);
+      }
+    }
+    len2code(litlen, litcode = dd->litcode, nlit);
+    len2code(distlen, distcode = dd->distcode, ndist);
+
+    for (i = 0; i<dd->nsym; i++) {
+      unsigned lit = dd->symlit[i], dist = dd->symdist[i], sym;
+
+      if (!dist) bitbuf_put(bb, litcode[lit], litlen[lit]);
+      else {
+        sym = dd->lensym[lit-3];
+        bitbuf_put(bb, litcode[257+sym], litlen[257+sym]);
+        bitbuf_put(bb, lit-dd->lenbase[sym], dd->lenbits[sym]);
+        sym = dd->distsym[dist<=256 ? dist-1 : 256+((dist-1)>>7)];
+        bitbuf_put(bb, distcode[sym], distlen[sym]);
+        bitbuf_put(bb, dist-dd->distbase[sym], dd->distbits[sym]);
+      }
+    }
+    bitbuf_put(bb, litcode[256], litlen[256]);
+  }
+
+  memset(dd->litfreq, 0, sizeof(dd->litfreq));
+  memset(dd->distfreq, 0, sizeof(dd->distfreq));
+  dd->nsym = dd->extrabits = 0;
+}
+
+// Record a literal (dist 0) or a length/distance pair for the current block
+static int deflate_sym(struct deflate *dd, unsigned lit, unsigned dist)
+{
+  dd->symlit[dd->nsym] = lit;
+  dd->symdist[dd->nsym] = dist;
+  if (!dist) dd->litfreq[lit]++;
+  else {
+    int sym = dd->lensym[lit-3];
+
+    dd->litfreq[257+sym]++;
+    dd->extrabits += dd->lenbits[sym];
+    sym = dd->distsym[dist<=256 ? dist-1 : 256+((dist-1)>>7)];
+    dd->distfreq[sym]++;
+    dd->extrabits += dd->distbits[sym];
+  }
+
+  return ++dd->nsym == DEFLATE_SYMS;
+}
+
+// Add strings starting at dd->ins up to pos to the hash chains (while there
+// are at least 3 bytes to hash), returning next older string with pos's hash.
+static unsigned deflate_hash(struct deflate *dd, unsigned pos, unsigned end)
+{
+  unsigned char *w = (void *)dd->data;
+  unsigned h;
+
+  for (; dd->ins<=pos && dd->ins+2<end; dd->ins++) {
+    h = ((w[dd->ins]<<10)^(w[dd->ins+1]<<5)^w[dd->ins+2])&32767;
+    dd->hashchain[dd->ins&32767] = dd->hashhead[h];
+    dd->hashhead[h] = dd->ins;
+  }
+
+  return pos<dd->ins ? dd->hashchain[pos&32767] : 0;
+}
+
+// Find longest match for string at pos (up to end) better than bestlen,
+// following hash chain from cand. Returns length, distance in dd->dist.
+static unsigned deflate_match(struct deflate *dd, unsigned cand, unsigned pos,
+  unsigned end, unsigned bestlen)
+{
+  unsigned char *w = (void *)dd->data, *scan = w+pos, *m;
+  unsigned chain = dd->chain, max = end-pos, len,
+    limit = pos>32768-262 ? pos-(32768-262) : 0;
+
+  if (max>258) max = 258;
+  if (bestlen>=dd->good) chain >>= 2;
+  while (cand>limit && cand<pos && bestlen<max) {
+    m = w+cand;
+    if (m[bestlen]==scan[bestlen] && *m==*scan && m[1]==scan[1]) {
+      for (len = 2; len<max && m[len]==scan[len]; len++);
+      if (len>bestlen) {
+        bestlen = len;
+        dd->dist = pos-cand;
+        if (len>=dd->nice) break;
+      }
+    }
+    if (!--chain) break;
+    cand = dd->hashchain[cand&32767];
+  }
+
+  return bestlen;
+}
 
-    // repeat until spanked
-    while (dd->pos != dd->len) {
-      unsigned pos = dd->pos&65535;
+// Deflate from dd->infd to bitbuf at compression level 1-9
+// dd->data is a 64k window: when the second half fills we move it down
+// to the first half, so matches can reach back up to 32k.
+static void deflate(struct deflate *dd, struct bitbuf *bb, int level)
+{
+  unsigned short *lv = deflate_levels[level-1];
+  char *data = dd->data;
+  unsigned pos = 0, end = 0, block = 0, len, dist, next, nextdist, cand, i;
+  int eof = 0;
 
-      bitbuf_put(bb, data[pos], 8);
+  dd->crc = ~0;
+  dd->good = lv[0];
+  dd->nice = lv[2];
+  dd->chain = lv[3];
+  dd->ins = 0;
+
+  for (;;) {
+    // Keep at least one maximal match (plus hash bytes) of lookahead
+    if (!eof && end-pos<262) {
+      if (end == 65536) {
+        if (block<32768) {
+          deflate_block(dd, bb, data+block, pos-block, 0);
+          block = pos;
+        }
+        memmove(data, data+32768, 32768);
+        for (i = 0; i<32768; i++) {
+          dd->hashhead[i] = dd->hashhead[i]>32768 ? dd->hashhead[i]-32768 : 0;
+          dd->hashchain[i] = dd->hashchain[i]>32768 ? dd->hashchain[i]-32768 :0;
+        }
+        pos -= 32768;
+        end -= 32768;
+        block -= 32768;
+        dd->ins -= 32768;
+      }
+      len = readall(dd->infd, data+end, 65536-end);
+      if (len == -1) perror_exit("read"); // TODO: add filename
+      if (len != 65536-end) eof++;
+      if (dd->crcfunc) dd->crcfunc(dd, data+end, len);
+      end += len;
+    }
+    if (pos == end) break;
+
+    // Greedy or lazy matching
+    len = 2;
+    if ((cand = deflate_hash(dd, pos, end)))
+      len = deflate_match(dd, cand, pos, end, len);
+    dist = dd->dist;
+    if (len>2 && level>3) {
+      // Is there a longer match starting at the next byte?
+      while (len<lv[1] && pos+1<end) {
+        next = 2;
+        if ((cand = deflate_hash(dd, pos+1, end)))
+          next = deflate_match(dd, cand, pos+1, end, len);
+        if (next<=len) break;
+        nextdist = dd->dist;
+        if (deflate_sym(dd, (unsigned char)data[pos++], 0)) {
+          deflate_block(dd, bb, data+block, pos-block, 0);
+          block = pos;
+        }
+        len = next;
+        dist = nextdist;
+      }
+    }
 
-      // need to refill buffer?
-      if (!(32767 & ++dd->pos) && !final) break;
+    // Distant 3 byte matches cost more than the literals
+    if (len>3 || (len==3 && dist<=4096)) {
+      i = deflate_sym(dd, len, dist);
+      if (level>3 || len<=lv[1]) deflate_hash(dd, pos+len-1, end);
+      pos += len;
+      if (dd->ins<pos) dd->ins = pos;
+    } else i = deflate_sym(dd, (unsigned char)data[pos++], 0);
+    if (i) {
+      deflate_block(dd, bb, data+block, pos-block, 0);
+      block = pos;
     }
   }
+  deflate_block(dd, bb, data+block, pos-block, 1);
   bitbuf_flush(bb);
 }
 
@@ -370,13 +681,17 @@ static void deflate(struct deflate *dd, struct bitbuf *bb)
 static struct deflate *init_deflate(int compress)
 {
   int i, n = 1;
-  struct deflate *dd = xmalloc(sizeof(struct deflate)+32768*(compress ? 4 : 1));
+  struct deflate *dd = xmalloc(sizeof(struct deflate)+32768*(compress ? 8 : 1));
 
   memset(dd, 0, sizeof(struct deflate));
-  // decompress needs 32k history, compress adds 64k hashhead and 32k hashchain
+  // decompress needs 32k history, compress uses a 64k window, 64k hashhead,
+  // 64k hashchain, and 64k of symbols for the current block
   if (compress) {
     dd->hashhead = (unsigned short *)(dd->data+65536);
-    dd->hashchain = (unsigned short *)(dd->data+65536+32768);
+    dd->hashchain = (unsigned short *)(dd->data+2*65536);
+    dd->symlit = (unsigned short *)(dd->data+3*65536);
+    dd->symdist = dd->symlit+DEFLATE_SYMS;
+    memset(dd->hashhead, 0, 65536);
   }
 
   // Calculate lenbits, lenbase, distbits, distbase
@@ -400,6 +715,16 @@ static struct deflate *init_deflate(int compress)
     dd->distbits[i] = n;
   }
 
+  // Reverse lookup of length and distance codes for deflate
+  if (compress) {
+    for (i = 0; i<sizeof(dd->lenbits); i++)
+      for (n = 0; n < 1<<dd->lenbits[i] && dd->lenbase[i]+n<259; n++)
+        dd->lensym[dd->lenbase[i]+n-3] = i;
+    for (i = 0; i<sizeof(dd->distbits); i++)
+      for (n = dd->distbase[i]; n < dd->distbase[i]+(1<<dd->distbits[i]); n++)
+        dd->distsym[n<=256 ? n-1 : 256+((n-1)>>7)] = i;
+  }
+
 // TODO layout and lifetime of this?
   // Init fixed huffman tables
   for (i=0; i<288; i++) libbuf[i] = 8 + (i>143) - ((i>255)<<1) + (i>279);
@@ -456,7 +781,7 @@ unsigned adler32(char *buf, unsigned len, unsigned crc)
 }
 */
 
-long long gzip_fd(int infd, int outfd)
+long long gzip_fd(int infd, int outfd, int level)
 {
   struct bitbuf *bb = bitbuf_init(outfd, 4096);
   struct deflate *dd = init_deflate(1);
@@ -464,17 +789,19 @@ long long gzip_fd(int infd, int outfd)
 
   // Header from RFC 1952 section 2.2:
   // 2 ID bytes (1F, 8b), gzip method byte (8=deflate), FLAG byte (none),
-  // 4 byte MTIME (zeroed), Extra Flags (2=maximum compression),
+  // 4 byte MTIME (zeroed), Extra Flags (2=maximum compression, 4=fastest),
   // Operating System (FF=unknown)
 
   dd->infd = infd;
-  xwrite(bb->fd, "\x1f\x8b\x08\0\0\0\0\0\x02\xff", 10);
+  xwrite(bb->fd, level==9 ? "\x1f\x8b\x08\0\0\0\0\0\x02\xff"
+    : level==1 ? "\x1f\x8b\x08\0\0\0\0\0\x04\xff"
+    : "\x1f\x8b\x08\0\0\0\0\0\0\xff", 10);
 
   // Little endian crc table
   crc_init(dd->crctable, 1);
   dd->crcfunc = gzip_crc;
 
-  deflate(dd, bb);
+  deflate(dd, bb, level);
 
   // tail: crc32, len32
 
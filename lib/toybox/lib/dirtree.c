@@ -4,6 +4,7 @@
  */
 
 #include "toys.h"
+#include <pthread.h>
 
 int isdotdot(char *name)
 {
@@ -29,9 +30,13 @@ struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
 {
   struct dirtree *dt = 0;
   struct stat st;
+  char link[4096]; // not libbuf, dirtree_parallel() calls this from threads
   int len = 0, linklen = 0, statless = 0;
 
-  if (name) {
+  if (name && parent && (flags&DIRTREE_NOSTAT)) {
+    memset(&st, 0, sizeof(st));
+    len = strlen(name);
+  } else if (name) {
     // open code fd = because haven't got node to call dirtree_parentfd() on yet
     int fd = parent ? parent->dirfd : AT_FDCWD,
       sym = AT_SYMLINK_NOFOLLOW*!(flags&DIRTREE_SYMFOLLOW);
@@ -45,8 +50,8 @@ struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
       }
     }
     if (!statless && S_ISLNK(st.st_mode)) {
-      if (0>(linklen = readlinkat(fd, name, libbuf, 4095))) goto error;
-      libbuf[linklen++]=0;
+      if (0>(linklen = readlinkat(fd, name, link, 4095))) goto error;
+      link[linklen++]=0;
     }
     len = strlen(name);
   }
@@ -59,7 +64,7 @@ struct dirtree *dirtree_add_node(struct dirtree *parent, char *name, int flags)
   else memcpy(&dt->st, &st, sizeof(struct stat));
   if (name) strcpy(dt->name, name);
   else *dt->name = 0, dt->st.st_mode = S_IFDIR;
-  if (linklen) dt->symlink = memcpy(len+(char *)dt, libbuf, linklen);
+  if (linklen) dt->symlink = memcpy(len+(char *)dt, link, linklen);
 
   return dt;
 
@@ -109,6 +114,106 @@ int dirtree_parentfd(struct dirtree *node)
   return node->parent ? node->parent->dirfd : AT_FDCWD;
 }
 
+// Fill in node->st for a node DIRTREE_NOSTAT didn't stat. (Only from the
+// callback, while the parent directory is still open. Doesn't fill in
+// node->symlink.) Returns 0, or -1 with errno set if stat failed.
+int dirtree_stat(struct dirtree *node)
+{
+  if (node->st.st_nlink || node->st.st_blksize) return 0;
+
+  return fstatat(dirtree_parentfd(node), node->name, &node->st,
+    AT_SYMLINK_NOFOLLOW);
+}
+
+// Read a directory's entries in big batches. On Linux that's getdents64(),
+// which fits hundreds of entries per syscall where readdir() fits dozens.
+struct dirbuf {
+  DIR *dir;
+  char *buf;
+  int fd, dot, len, pos;
+};
+
+static int dirbuf_open(struct dirbuf *db, int dirfd)
+{
+  memset(db, 0, sizeof(*db));
+  db->dot = -1;
+#ifdef __linux__
+  // Read dirfd directly, only AT_FDCWD needs opening (and closing) first.
+  if (AT_FDCWD == dirfd)
+    dirfd = db->dot = open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+  return (db->fd = dirfd) != -1;
+#else
+  // fdopendir() doesn't support AT_FDCWD, closedir() closes fd from opendir()
+  if (AT_FDCWD == dirfd) db->dir = opendir(".");
+  else if (dirfd != -1) db->dir = fdopendir(xdup(dirfd));
+
+  return !!db->dir;
+#endif
+}
+
+// Returns name of next entry and sets *type to its d_type, 0 at the end.
+static char *dirbuf_next(struct dirbuf *db, int *type)
+{
+#ifdef __linux__
+  struct {
+    unsigned long long ino;
+    long long off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+  } *de;
+
+  if (db->pos >= db->len) {
+    if (!db->buf) db->buf = xmalloc(32768);
+    if (1>(db->len = syscall(SYS_getdents64, db->fd, db->buf, 32768))) return 0;
+    db->pos = 0;
+  }
+  de = (void *)(db->buf+db->pos);
+  db->pos += de->reclen;
+  *type = de->type;
+
+  return de->name;
+#else
+  struct dirent *entry = readdir(db->dir);
+
+  if (!entry) return 0;
+  *type = entry->d_type;
+
+  return entry->d_name;
+#endif
+}
+
+static void dirbuf_close(struct dirbuf *db)
+{
+  if (db->dir) closedir(db->dir);
+  if (db->dot != -1) close(db->dot);
+  free(db->buf);
+}
+
+// Make the node for an entry of node's directory, or return 0 to skip it.
+static struct dirtree *dirtree_entry(struct dirtree *node, char *name,
+  int type, int flags)
+{
+  struct dirtree *new;
+  int need;
+
+  if ((flags&DIRTREE_PROC) && !isdigit(*name)) return 0;
+  if ((flags&DIRTREE_BREADTH) && isdotdot(name)) return 0;
+  // NOSTAT still stats directories (callers want st_dev and st_ino to
+  // spot loops), symlinks we'd follow, and entries d_type doesn't know.
+  need = type==DT_UNKNOWN || type==DT_DIR
+    || (type==DT_LNK && (flags&DIRTREE_SYMFOLLOW));
+  if (!(new = dirtree_add_node(node, name, flags&~(DIRTREE_NOSTAT*need))))
+    return 0;
+  if ((flags&DIRTREE_SYMFOLLOW) && type==DT_LNK
+    && !S_ISLNK(new->st.st_mode)) new->again |= DIRTREE_SYMFOLLOW;
+  if (!new->st.st_blksize && !new->st.st_mode)
+    new->st.st_mode = type<<12;
+
+  return new;
+}
+
 // Handle callback for a node in the tree. Returns saved node(s) if
 // callback returns DIRTREE_SAVE, otherwise frees consumed nodes and
 // returns NULL. If !callback return top node unchanged.
@@ -153,14 +258,11 @@ int dirtree_recurse(struct dirtree *node,
           int (*callback)(struct dirtree *node), int dirfd, int flags)
 {
   struct dirtree *new = 0, *next, **ddt = &(node->child);
-  struct dirent *entry;
-  DIR *dir = 0;
-
-  // fdopendir() doesn't support AT_FDCWD, closedir() closes fd from opendir()
-  if (AT_FDCWD == (node->dirfd = dirfd)) dir = opendir(".");
-  else if (node->dirfd != -1) dir = fdopendir(xdup(node->dirfd));
+  struct dirbuf db;
+  char *name;
+  int type;
 
-  if (!dir) {
+  if (!dirbuf_open(&db, node->dirfd = dirfd)) {
     if (!(flags & DIRTREE_SHUTUP)) {
       char *path = dirtree_path(node, 0);
       perror_msg_raw(path);
@@ -176,16 +278,10 @@ int dirtree_recurse(struct dirtree *node,
     else if (new == DIRTREE_ABORTVAL) goto done;
     else ddt = &new->next;
 
-  // according to the fddir() man page, the filehandle in the DIR * can still
-  // be externally used by things that don't lseek() it.
-  } else while ((entry = readdir(dir))) {
-    if ((flags&DIRTREE_PROC) && !isdigit(*entry->d_name)) continue;
-    if ((flags&DIRTREE_BREADTH) && isdotdot(entry->d_name)) continue;
-    if (!(new = dirtree_add_node(node, entry->d_name, flags))) continue;
-    if ((flags&DIRTREE_SYMFOLLOW) && entry->d_type==DT_LNK
-      && !S_ISLNK(new->st.st_mode)) new->again |= DIRTREE_SYMFOLLOW;
-    if (!new->st.st_blksize && !new->st.st_mode)
-      new->st.st_mode = entry->d_type<<12;
+  // The directory is read from node->dirfd, so the callback can still use
+  // that for things that don't lseek() it.
+  } else while ((name = dirbuf_next(&db, &type))) {
+    if (!(new = dirtree_entry(node, name, type, flags))) continue;
     new = dirtree_handle_callback(new, callback);
     if (new == DIRTREE_ABORTVAL) goto done;
     if (new) {
@@ -201,7 +297,7 @@ int dirtree_recurse(struct dirtree *node,
   }
 
 done:
-  closedir(dir);
+  dirbuf_close(&db);
   node->dirfd = -1;
 
   return (new == DIRTREE_ABORTVAL) ? DIRTREE_ABORT : flags;
@@ -225,3 +321,339 @@ struct dirtree *dirtree_read(char *path, int (*callback)(struct dirtree *node))
 {
   return dirtree_flagread(path, 0, callback);
 }
+
+// Parallel walks: each thread has a deque of directories to read, takes its
+// own newest and steals other threads' oldest. In unordered mode the reader
+// calls back the entries and queues the subdirectories, and a directory
+// stays open until everything under it is done (node->pending counts what's
+// left). In ordered mode the calling thread does every callback, and the
+// workers just read the subdirectories it's about to get to, into ->child
+// (node->pending is 1 while that's happening and 2 when it's done).
+
+struct dirjob {
+  struct dirtree *node;
+  int flags;
+};
+
+struct dirpool {
+  pthread_mutex_t lock;
+  pthread_cond_t work, ready;
+  int (*callback)(struct dirtree *node);
+  struct dirworker {
+    struct dirpool *pool;
+    pthread_t thread;
+    struct dirjob *job;
+    int start, len, size;
+  } *w;
+  int nw, next, ordered, idle, ahead, done, stop;
+};
+
+// Add a job to w's deque. Call with pool->lock held.
+static void dirpool_push(struct dirworker *w, struct dirtree *node, int flags)
+{
+  if (w->start+w->len == w->size) {
+    if (w->start) memmove(w->job, w->job+w->start, w->len*sizeof(*w->job));
+    else w->job = xrealloc(w->job, (w->size = 2*w->size+16)*sizeof(*w->job));
+    w->start = 0;
+  }
+  w->job[w->start+w->len++] = (struct dirjob){node, flags};
+  if (w->pool->idle) pthread_cond_signal(&w->pool->work);
+}
+
+// Take w's newest job (oldest in ordered mode, where they're queued in the
+// order they'll be needed), else another thread's oldest. Call with lock held.
+static int dirpool_take(struct dirworker *w, struct dirjob *job)
+{
+  struct dirpool *pool = w->pool;
+  struct dirworker *v = w;
+  int i;
+
+  for (i = 0; i<pool->nw; i++, v = pool->w+(v+1-pool->w)%pool->nw) {
+    if (!v->len) continue;
+    if (v == w && !pool->ordered) *job = v->job[v->start+v->len-1];
+    else *job = v->job[v->start++];
+    if (!--v->len) v->start = 0;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+// Take node's job back off whichever deque it's on. Call with lock held.
+static int dirpool_unqueue(struct dirpool *pool, struct dirtree *node)
+{
+  struct dirworker *w;
+  int i;
+
+  for (w = pool->w; w<pool->w+pool->nw; w++)
+    for (i = w->start; i<w->start+w->len; i++) if (w->job[i].node == node) {
+      memmove(w->job+i, w->job+i+1, (w->start+--w->len-i)*sizeof(*w->job));
+
+      return 1;
+    }
+
+  return 0;
+}
+
+// Open and read node's directory, calling back each entry and queueing the
+// subdirectories on w, or in ordered mode saving them all in node->child.
+static void dirpool_read(struct dirpool *pool, struct dirworker *w,
+  struct dirtree *node, int flags)
+{
+  struct dirtree *new, **ddt = &node->child;
+  struct dirbuf db;
+  char *name;
+  int type, fd = AT_FDCWD, r, abort;
+
+  if (*node->name) fd = openat(dirtree_parentfd(node), node->name, O_CLOEXEC);
+  if (!dirbuf_open(&db, node->dirfd = fd)) {
+    if (!(flags & DIRTREE_SHUTUP)) {
+      char *path = dirtree_path(node, 0);
+      perror_msg_raw(path);
+      free(path);
+    }
+  } else while ((name = dirbuf_next(&db, &type))) {
+    if (!(new = dirtree_entry(node, name, type, flags))) continue;
+    if (pool->ordered) {
+      *ddt = new;
+      ddt = &new->next;
+
+      continue;
+    }
+    r = pool->callback(new);
+    abort = (r&DIRTREE_ABORT)==DIRTREE_ABORT;
+    if (abort || (S_ISDIR(new->st.st_mode)
+      && (r&(DIRTREE_RECURSE|DIRTREE_COMEAGAIN))))
+    {
+      pthread_mutex_lock(&pool->lock);
+      if (abort) pool->stop = 1;
+      else if (!(abort = pool->stop)) {
+        node->pending++;
+        dirpool_push(w, new, r);
+        new = 0;
+      }
+      pthread_mutex_unlock(&pool->lock);
+    }
+    free(new);
+    if (abort) break;
+  }
+  dirbuf_close(&db);
+}
+
+// Done with one of the things under a directory in unordered mode. After the
+// last, call it back again if it asked, close it, and tell its parent.
+static void dirpool_finish(struct dirpool *pool, struct dirtree *node)
+{
+  struct dirtree *parent;
+  int left, stop;
+
+  for (; node; node = parent) {
+    pthread_mutex_lock(&pool->lock);
+    left = --node->pending;
+    stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+    if (left) return;
+
+    if ((node->again&DIRTREE_COMEAGAIN) && !stop
+      && (pool->callback(node)&DIRTREE_ABORT)==DIRTREE_ABORT)
+    {
+      pthread_mutex_lock(&pool->lock);
+      pool->stop = 1;
+      pthread_mutex_unlock(&pool->lock);
+    }
+    if (node->dirfd>=0) close(node->dirfd);
+    if (!(parent = node->parent)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->done = 1;
+      pthread_cond_broadcast(&pool->work);
+      pthread_mutex_unlock(&pool->lock);
+    }
+    free(node);
+  }
+}
+
+static void *dirpool_work(void *arg)
+{
+  struct dirworker *w = arg;
+  struct dirpool *pool = w->pool;
+  struct dirjob job;
+  int stop;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->done) {
+    if (!dirpool_take(w, &job)) {
+      pool->idle++;
+      pthread_cond_wait(&pool->work, &pool->lock);
+      pool->idle--;
+
+      continue;
+    }
+    job.node->pending = 1;
+    stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->ordered) dirpool_read(pool, w, job.node, job.flags);
+    else {
+      // Nothing looks at this before the second call
+      if (job.flags&DIRTREE_COMEAGAIN) job.node->again |= DIRTREE_COMEAGAIN;
+      if (!stop) dirpool_read(pool, w, job.node, job.flags);
+      else job.node->dirfd = -1;
+      dirpool_finish(pool, job.node);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->ordered) {
+      job.node->pending = 2;
+      pthread_cond_broadcast(&pool->ready);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+// Wait for (or cancel) a worker reading node's directory ahead in ordered
+// mode. Returns 1 if it was read.
+static int dirpool_fetch(struct dirpool *pool, struct dirtree *node)
+{
+  int read = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  if (dirpool_unqueue(pool, node)) pool->ahead--;
+  else {
+    while (node->pending == 1) pthread_cond_wait(&pool->ready, &pool->lock);
+    if (node->pending) {
+      pool->ahead--;
+      read++;
+    }
+  }
+  node->pending = 0;
+  pthread_mutex_unlock(&pool->lock);
+
+  return read;
+}
+
+// Discard a directory read ahead and close it.
+static void dirpool_drop(struct dirtree *node)
+{
+  struct dirtree *next;
+
+  for (; node->child; node->child = next) {
+    next = node->child->next;
+    free(node->child);
+  }
+  if (node->dirfd>=0) close(node->dirfd);
+  node->dirfd = -1;
+}
+
+// Ordered mode: call back node's entries, descending into subdirectories,
+// then node itself again if flags asked. Subdirectories were read ahead with
+// guess, the flags their parent's callback returned, so a callback returning
+// different flags gets its directory read again.
+static int dirpool_walk(struct dirpool *pool, struct dirtree *node, int flags,
+  int guess)
+{
+  struct dirtree *new, *ahead;
+  int read = 0, r = 0, df = DIRTREE_RECURSE|DIRTREE_COMEAGAIN;
+
+  if (dirpool_fetch(pool, node)) {
+    read++;
+    if ((flags^guess)&(DIRTREE_SYMFOLLOW|DIRTREE_SHUTUP|DIRTREE_PROC
+      |DIRTREE_STATLESS|DIRTREE_NOSTAT)) dirpool_drop(node), read = 0;
+  }
+  if (!read) dirpool_read(pool, 0, node, flags);
+
+  for (ahead = node->child; (new = node->child); free(new)) {
+    node->child = new->next;
+    if (ahead == new) ahead = new->next;
+    if ((r&DIRTREE_ABORT)==DIRTREE_ABORT) {
+      if (dirpool_fetch(pool, new)) dirpool_drop(new);
+
+      continue;
+    }
+
+    // Keep the workers a few directories ahead
+    pthread_mutex_lock(&pool->lock);
+    for (; ahead && pool->ahead<16*pool->nw; ahead = ahead->next) {
+      if (!S_ISDIR(ahead->st.st_mode) || isdotdot(ahead->name)) continue;
+      dirpool_push(pool->w+pool->next++%pool->nw, ahead, flags);
+      pool->ahead++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    r = pool->callback(new);
+    if (S_ISDIR(new->st.st_mode) && (r&df)) r = dirpool_walk(pool, new, r, flags);
+    else if (dirpool_fetch(pool, new)) dirpool_drop(new);
+  }
+
+  if ((r&DIRTREE_ABORT)!=DIRTREE_ABORT && (flags&DIRTREE_COMEAGAIN)) {
+    node->again |= DIRTREE_COMEAGAIN;
+    flags = pool->callback(node);
+  }
+  dirpool_drop(node);
+
+  return (r&DIRTREE_ABORT)==DIRTREE_ABORT ? DIRTREE_ABORT : flags;
+}
+
+// Like dirtree_flagread() but reading directories with a thread per CPU.
+// Callbacks run in all the threads at once, each directory's entries in one
+// thread in order and its COMEAGAIN call after everything under it. With
+// DIRTREE_ORDERED they happen in the calling thread in dirtree_read() order,
+// while the other threads read (and stat) the directories it's coming to.
+// Nodes aren't saved, DIRTREE_SAVE and DIRTREE_BREADTH are ignored.
+// $DIRTREE_THREADS overrides the thread count (1 walks sequentially).
+// Returns DIRTREE_ABORTVAL if path didn't exist or the callback aborted.
+struct dirtree *dirtree_parallel(char *path, int flags,
+  int (*callback)(struct dirtree *node))
+{
+  struct dirpool pool;
+  struct dirtree *root;
+  char *s = getenv("DIRTREE_THREADS");
+  long n = s ? atolx(s) : sysconf(_SC_NPROCESSORS_ONLN);
+  int r, i, started;
+
+  if (n<2) return dirtree_flagread(path, flags, callback);
+  if (!(root = dirtree_add_node(0, path, flags))) return DIRTREE_ABORTVAL;
+  r = callback(root);
+  if (!S_ISDIR(root->st.st_mode) || !(r&(DIRTREE_RECURSE|DIRTREE_COMEAGAIN))) {
+    free(root);
+
+    return (r&DIRTREE_ABORT)==DIRTREE_ABORT ? DIRTREE_ABORTVAL : 0;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pthread_mutex_init(&pool.lock, 0);
+  pthread_cond_init(&pool.work, 0);
+  pthread_cond_init(&pool.ready, 0);
+  pool.callback = callback;
+  pool.ordered = !!(flags&DIRTREE_ORDERED);
+  pool.w = xzalloc((pool.nw = n>8 ? 8 : n)*sizeof(*pool.w));
+  for (i = 0; i<pool.nw; i++) pool.w[i].pool = &pool;
+
+  // In unordered mode this thread is the first worker.
+  for (started = i = !pool.ordered; i<pool.nw; started = ++i)
+    if (pthread_create(&pool.w[i].thread, 0, dirpool_work, pool.w+i)) break;
+  if (pool.ordered) r = dirpool_walk(&pool, root, r, r);
+  else {
+    pthread_mutex_lock(&pool.lock);
+    dirpool_push(pool.w, root, r);
+    pthread_mutex_unlock(&pool.lock);
+    dirpool_work(pool.w);
+    r = pool.stop ? DIRTREE_ABORT : 0;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.done = 1;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+  for (i = !pool.ordered; i<started; i++) pthread_join(pool.w[i].thread, 0);
+  for (i = 0; i<pool.nw; i++) free(pool.w[i].job);
+  free(pool.w);
+  if (pool.ordered) free(root);
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.work);
+  pthread_cond_destroy(&pool.ready);
+
+  return (r&DIRTREE_ABORT)==DIRTREE_ABORT ? DIRTREE_ABORTVAL : 0;
+}
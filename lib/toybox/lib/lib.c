@@ -766,7 +766,7 @@ static void loopfile_lines_bridge(int fd, char *name)
 void loopfiles_lines(char **argv, void (*function)(char **pline, long len))
 {
   do_lines_bridge = function;
-  // No O_CLOEXEC because we need to call fclose.
+  // No O_CLOEXEC because do_lines() closes it.
   loopfiles_rw(argv, O_RDONLY|WARN_ONLY, 0, loopfile_lines_bridge);
 }
 
@@ -1392,7 +1392,9 @@ int regexec0(regex_t *preg, char *string, long len, int nmatch,
   regmatch_t *pmatch, int eflags)
 {
   regmatch_t backup;
+  int rc = dfa_exec(preg, string, len, nmatch, pmatch, eflags);
 
+  if (rc != -1) return rc;
   if (!nmatch) pmatch = &backup;
   pmatch->rm_so = 0;
   pmatch->rm_eo = len;
@@ -1421,28 +1423,79 @@ char *getgroupname(gid_t gid)
   return gr ? gr->gr_name : gnum;
 }
 
-// Iterate over lines in file, calling function. Function can write 0 to
-// the line pointer if they want to keep it, or 1 to terminate processing,
-// otherwise line is freed. Passed file descriptor is closed at the end.
-// At EOF calls function(0, 0)
-void do_lines(int fd, char delim, void (*call)(char **pline, long len))
+// Buffered line reader: read big blocks from fd and hand out each line
+// (delimiter included, NUL terminated) in place, without allocating. The
+// line is only good until the next call, copy it to keep it.
+void linebuf_init(struct linebuf *lb, int fd, char delim)
 {
-  FILE *fp = xfdopen(fd, "r");
+  memset(lb, 0, sizeof(*lb));
+  lb->fd = fd;
+  lb->delim = delim;
+}
 
+// Returns next line and sets *len, or returns 0 at EOF (or read error).
+char *linebuf_next(struct linebuf *lb, long *len)
+{
+  char *line, *s;
+  long l;
+
+  // Put back the byte the last line's NUL terminator overwrote.
+  if (lb->start<lb->end) lb->buf[lb->start] = lb->save;
   for (;;) {
-    char *line = 0;
-    ssize_t len;
+    line = lb->buf+lb->start;
+    if ((s = memchr(line, lb->delim, lb->end-lb->start))) {
+      s++;
+      break;
+    }
+    if (lb->eof) {
+      if (lb->start == lb->end) return 0;
+      s = lb->buf+lb->end;
+      break;
+    }
 
-    len = getdelim(&line, (void *)&len, delim, fp);
-    if (len > 0) {
-      call(&line, len);
-      if (line == (void *)1) break;
-      free(line);
-    } else break;
+    // Move partial line to start of buffer, growing it if that's not enough
+    if (lb->start) {
+      memmove(lb->buf, line, lb->end -= lb->start);
+      lb->start = 0;
+    }
+    if (lb->end+1 >= lb->size)
+      lb->buf = xrealloc(lb->buf, lb->size = lb->size ? lb->size*2 : 65536);
+    if (0<(l = read(lb->fd, lb->buf+lb->end, lb->size-lb->end-1))) lb->end += l;
+    else if (!l || errno != EINTR) lb->eof = 1;
+  }
+  *len = s-line;
+  lb->start += *len;
+  lb->save = *s;
+  *s = 0;
+
+  return line;
+}
+
+void linebuf_free(struct linebuf *lb)
+{
+  free(lb->buf);
+  lb->buf = 0;
+}
+
+// Iterate over lines in file, calling function. The line is in a buffer
+// reused for the next line, so function must copy it to keep it. Function
+// can write 1 to the line pointer to terminate processing. Passed file
+// descriptor is closed at the end. At EOF calls function(0, 0)
+void do_lines(int fd, char delim, void (*call)(char **pline, long len))
+{
+  struct linebuf lb;
+  char *line;
+  long len;
+
+  linebuf_init(&lb, fd, delim);
+  while ((line = linebuf_next(&lb, &len))) {
+    call(&line, len);
+    if (line == (void *)1) break;
   }
   call(0, 0);
 
-  fclose(fp);
+  linebuf_free(&lb);
+  close(fd);
 }
 
 // Return unix time in milliseconds
@@ -69,6 +69,11 @@ void get_optflags(void);
 #define DIRTREE_STATLESS   128
 // Don't look at any more files in this directory.
 #define DIRTREE_ABORT      256
+// Only stat children that are directories (or d_type doesn't say), the rest
+// just get the file type in st_mode until dirtree_stat()
+#define DIRTREE_NOSTAT     512
+// dirtree_parallel(): call back in dirtree_read() order, one at a time
+#define DIRTREE_ORDERED   1024
 
 #define DIRTREE_ABORTVAL ((struct dirtree *)1)
 
@@ -76,7 +81,7 @@ struct dirtree {
   struct dirtree *next, *parent, *child;
   long extra; // place for user to store their stuff (can be pointer)
   char *symlink;
-  int dirfd;
+  int dirfd, pending; // pending: dirtree_parallel() bookkeeping
   struct stat st;
   char again, name[];
 };
@@ -86,11 +91,14 @@ struct dirtree *dirtree_add_node(struct dirtree *p, char *name, int flags);
 char *dirtree_path(struct dirtree *node, int *plen);
 int dirtree_notdotdot(struct dirtree *catch);
 int dirtree_parentfd(struct dirtree *node);
+int dirtree_stat(struct dirtree *node);
 int dirtree_recurse(struct dirtree *node, int (*callback)(struct dirtree *node),
   int dirfd, int symfollow);
 struct dirtree *dirtree_flagread(char *path, int flags,
   int (*callback)(struct dirtree *node));
 struct dirtree *dirtree_read(char *path, int (*callback)(struct dirtree *node));
+struct dirtree *dirtree_parallel(char *path, int flags,
+  int (*callback)(struct dirtree *node));
 
 // Tell xopen and friends to print warnings but return -1 as necessary
 // The largest O_BLAH flag so far is arch/alpha's O_PATH at 0x800000 so
@@ -267,6 +275,14 @@ int regexec0(regex_t *preg, char *string, long len, int nmatch,
   regmatch_t pmatch[], int eflags);
 char *getusername(uid_t uid);
 char *getgroupname(gid_t gid);
+struct linebuf {
+  char *buf, delim, save;
+  int fd, eof;
+  long size, start, end;
+};
+void linebuf_init(struct linebuf *lb, int fd, char delim);
+char *linebuf_next(struct linebuf *lb, long *len);
+void linebuf_free(struct linebuf *lb);
 void do_lines(int fd, char delim, void (*call)(char **pline, long len));
 long long millitime(void);
 char *format_iso_time(char *buf, size_t len, struct timespec *ts);
@@ -293,6 +309,13 @@ void elf_print_flags(int arch, int flags);
 
 void hash_by_name(int fd, char *name, char *result);
 
+// regex.c
+
+void dfa_comp(regex_t *preg, char *regex, int cflags);
+int dfa_exec(regex_t *preg, char *s, long len, int nmatch, regmatch_t *pmatch,
+  int eflags);
+void xregfree(regex_t *preg);
+
 // env.c
 
 long environ_bytes(void);
@@ -383,7 +406,7 @@ int comma_remove(char *optlist, char *opt);
 
 // deflate.c
 
-long long gzip_fd(int infd, int outfd);
+long long gzip_fd(int infd, int outfd, int level);
 long long gunzip_fd(int infd, int outfd);
 long long gunzip_mem(char *inbuf, int inlen, char *outbuf, int outlen);
 
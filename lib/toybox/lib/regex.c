@@ -0,0 +1,811 @@
+/* regex.c - Lazy DFA matcher for regular expressions compiled by xregcomp()
+ *
+ * Copyright 2026 The bootsh Authors
+ *
+ * musl's regexec() is a backtracking TRE matcher, slow enough to dominate
+ * grep and sed. So xregcomp() also parses the pattern into a Thompson NFA
+ * whose DFA states get built the first time the input needs them, and
+ * regexec0() runs that instead. libc still compiles every pattern and gets
+ * anything we can't do: backreferences, \< \> and other escapes, equivalence
+ * classes, non-ASCII patterns, and the offsets of subexpressions.
+ *
+ * Matches are leftmost longest, like POSIX. One unanchored pass finds
+ * whether there is a match and where the first one ends. Anchored passes
+ * from each candidate start before that end then find its start and
+ * longest end. When every match begins with the same literal text, memmem()
+ * skips to the candidates.
+ *
+ * In a UTF-8 locale '.' and [^...] consume a whole multibyte character, and
+ * patterns that could match a non-ASCII character any other way fall back
+ * to libc. Input isn't validated: libc refuses to match around bytes that
+ * aren't UTF-8, this doesn't.
+ *
+ * States get built during matching, so threads other than the one that
+ * compiled the regex (grep -r searching files in parallel) build their own,
+ * in a copy that shares the NFA. Don't xregfree() while they're running.
+ *
+ * Free an xregcomp() regex with xregfree(): plain regfree() leaves its DFA
+ * in the table until the same address gets compiled again.
+ */
+
+#include "toys.h"
+#include <pthread.h>
+
+// Syntax tree
+enum { RX_SET, RX_CAT, RX_ALT, RX_REP, RX_BOL, RX_EOL, RX_EMPTY };
+struct rxtree {
+  char op;
+  int a, b, min, max;  // children, or RX_SET's set in a; max -1 = unbounded
+};
+
+// NFA: RX_SET (byte set in alt), RX_ALT (split to next and alt), RX_BOL,
+// RX_EOL, RX_EMPTY (jump to next), RX_CAT (match)
+struct rxnode {
+  char op;
+  int next, alt;
+};
+
+// DFA state: the NFA nodes it's in, whether ^ holds and whether it keeps
+// restarting the pattern (unanchored search), and where each byte class goes.
+struct rxstate {
+  struct rxstate *chain;
+  unsigned hash;
+  char bol, unanch, accept, accepteol, dead;
+  int len, *set;
+  struct rxstate *next[];
+};
+
+struct dfa {
+  struct dfa *chain, *orig;
+  pthread_t owner;
+  regex_t key;
+  int cflags, nnode, start, ncls, nstate, flushes, memory, *stack, *work,
+    *mark, gen;
+  struct rxnode *node;
+  unsigned char (*sets)[32], cls[256], *prefix;
+  unsigned plen;
+  struct rxstate *hash[256], *starts[4];
+};
+
+// Parser state
+struct rxparse {
+  char *s;
+  int cflags, depth, utf8, fail;
+  struct rxtree *tree;
+  int ntree, nset;
+  unsigned char (*sets)[32];
+};
+
+#define RX_MAXNODE 20000
+#define RX_MAXMEM (1<<20)
+
+static struct dfa **dfas;
+static unsigned ndfas, dfasize;
+static pthread_key_t rxkey;
+
+static int rxtree(struct rxparse *rp, int op, int a, int b)
+{
+  struct rxtree *t;
+
+  if (!(rp->ntree&255))
+    rp->tree = xrealloc(rp->tree, (rp->ntree+256)*sizeof(*rp->tree));
+  t = rp->tree+rp->ntree;
+  t->op = op;
+  t->a = a;
+  t->b = b;
+  t->min = t->max = 0;
+
+  return rp->ntree++;
+}
+
+static int rxset(struct rxparse *rp, unsigned char *set)
+{
+  if (!(rp->nset&31))
+    rp->sets = xrealloc(rp->sets, (rp->nset+32)*sizeof(*rp->sets));
+  memcpy(rp->sets[rp->nset], set, 32);
+
+  return rxtree(rp, RX_SET, rp->nset++, 0);
+}
+
+static void rxrange(unsigned char *set, int lo, int hi)
+{
+  for (; lo<=hi; lo++) set[lo>>3] |= 1<<(lo&7);
+}
+
+// Any non-ASCII UTF-8 character
+static int rxmulti(struct rxparse *rp)
+{
+  unsigned char lead[32] = {0}, cont[32] = {0};
+  int rep;
+
+  rxrange(lead, 0xc0, 0xff);
+  rxrange(cont, 0x80, 0xbf);
+  rep = rxtree(rp, RX_REP, rxset(rp, cont), 0);
+  rp->tree[rep].max = -1;
+
+  return rxtree(rp, RX_CAT, rxset(rp, lead), rep);
+}
+
+// Turn a set of bytes (ASCII ones only in a UTF-8 locale) into a tree,
+// complementing, case folding and dropping newline as the flags say.
+static int rxchars(struct rxparse *rp, unsigned char *set, int neg)
+{
+  int i, top = rp->utf8 ? 128 : 256;
+
+  if (rp->cflags&REG_ICASE) for (i = 0; i<top; i++) {
+    if (set[i>>3]&(1<<(i&7))) {
+      rxrange(set, tolower(i), tolower(i));
+      rxrange(set, toupper(i), toupper(i));
+    }
+  }
+  if (neg) for (i = 0; i<top; i++) set[i>>3] ^= 1<<(i&7);
+  if (neg && (rp->cflags&REG_NEWLINE)) set['\n'>>3] &= ~(1<<('\n'&7));
+  if (!neg || !rp->utf8) return rxset(rp, set);
+
+  return rxtree(rp, RX_ALT, rxset(rp, set), rxmulti(rp));
+}
+
+// Bracket expression, after the [
+static int rxbracket(struct rxparse *rp)
+{
+  unsigned char set[32] = {0};
+  char *s = rp->s, *classes[] = {"alnum", "alpha", "blank", "cntrl", "digit",
+    "graph", "lower", "print", "punct", "space", "upper", "xdigit"};
+  int neg = 0, lo, hi, i, j, len;
+
+  if (*s == '^') {
+    neg = 1;
+    s++;
+  }
+  for (i = 0;; i++) {
+    if (!*s) return rp->fail++;
+    if (*s == ']' && i) break;
+    if (*s == '[' && (s[1] == '=' || s[1] == '.')) return rp->fail++;
+    if (*s == '[' && s[1] == ':') {
+      for (j = 0; j<ARRAY_LEN(classes); j++) {
+        len = strlen(classes[j]);
+        if (!strncmp(s+2, classes[j], len) && !strncmp(s+2+len, ":]", 2))
+          break;
+      }
+      if (j == ARRAY_LEN(classes)) return rp->fail++;
+      // Only these have no members outside ASCII in a UTF-8 locale
+      if (rp->utf8 && !((1<<2|1<<4|1<<11)&(1<<j))) return rp->fail++;
+      for (lo = 0; lo<(rp->utf8 ? 128 : 256); lo++) {
+        int (*is[])(int) = {isalnum, isalpha, isblank, iscntrl, isdigit,
+          isgraph, islower, isprint, ispunct, isspace, isupper, isxdigit};
+
+        if (is[j](lo)) rxrange(set, lo, lo);
+      }
+      s += 4+len;
+      continue;
+    }
+    lo = *(unsigned char *)s++;
+    hi = lo;
+    if (*s == '-' && s[1] && s[1] != ']') {
+      if (s[1] == '[') return rp->fail++;
+      hi = *(unsigned char *)(s+1);
+      s += 2;
+    }
+    if (rp->utf8 && hi>127) return rp->fail++;
+    rxrange(set, lo, hi);
+  }
+  rp->s = s+1;
+
+  return rxchars(rp, set, neg);
+}
+
+static int rxliteral(struct rxparse *rp, int c)
+{
+  unsigned char set[32] = {0};
+
+  if (rp->utf8 && c>127) return rp->fail++;
+  rxrange(set, c, c);
+
+  return rxchars(rp, set, 0);
+}
+
+static int rxdot(struct rxparse *rp)
+{
+  unsigned char set[32] = {0};
+
+  return rxchars(rp, set, 1);
+}
+
+// Parse {m,n} (or \{m,n\}) after the brace into a repeat of t.
+static int rxinterval(struct rxparse *rp, int t)
+{
+  char *s = rp->s;
+  int min = 0, max;
+
+  if (!isdigit(*s) && *s != ',') return rp->fail++;
+  while (isdigit(*s)) min = min*10+*s++-'0';
+  max = min;
+  if (*s == ',') {
+    max = -1;
+    if (isdigit(*++s)) for (max = 0; isdigit(*s);) max = max*10+*s++-'0';
+  }
+  if (!(rp->cflags&REG_EXTENDED) && *s++ != '\\') return rp->fail++;
+  if (*s++ != '}' || min>255 || max>255 || (max != -1 && max<min))
+    return rp->fail++;
+  rp->s = s;
+  t = rxtree(rp, RX_REP, t, 0);
+  rp->tree[t].min = min;
+  rp->tree[t].max = max;
+
+  return t;
+}
+
+static int rxalt(struct rxparse *rp);
+
+// One atom and the repeats after it
+static int rxatom(struct rxparse *rp, int first)
+{
+  int ere = rp->cflags&REG_EXTENDED, t, c = *rp->s++;
+
+  if (c == '[') t = rxbracket(rp);
+  else if (c == '.') t = rxdot(rp);
+  else if (c == '^' && (ere || first == 1)) {
+    // Whether BRE ^ after \( is an anchor is up to the implementation
+    if (rp->depth && !ere) return rp->fail++;
+    t = rxtree(rp, RX_BOL, 0, 0);
+  } else if (c == '$' && (ere || !*rp->s)) t = rxtree(rp, RX_EOL, 0, 0);
+  else if (c == '$' && !strncmp(rp->s, "\\)", 2)) return rp->fail++;
+  else if (ere && c == '(') {
+    rp->depth++;
+    t = rxalt(rp);
+    if (*rp->s++ != ')') return rp->fail++;
+    rp->depth--;
+  } else if (ere && strchr("*+?{", c)) return rp->fail++;
+  else if (c == '\\') {
+    c = *rp->s++;
+    if (!ere && c == '(') {
+      rp->depth++;
+      t = rxalt(rp);
+      if (strncmp(rp->s, "\\)", 2)) return rp->fail++;
+      rp->s += 2;
+      rp->depth--;
+    } else if (c && strchr(".[]\\*^$/", c)) t = rxliteral(rp, c);
+    else if (c && ere && strchr("+?(){}|", c)) t = rxliteral(rp, c);
+    else return rp->fail++;
+  } else t = rxliteral(rp, c);
+
+  for (;;) {
+    if (rp->fail) return 0;
+    c = *rp->s;
+    // BRE * after ^ is literal, ERE ^* is undefined
+    if (rp->tree[t].op == RX_BOL || rp->tree[t].op == RX_EOL) {
+      if (ere && strchr("*+?{", c)) return rp->fail++;
+      break;
+    }
+    if (c == '*' || (ere && (c == '+' || c == '?'))) {
+      rp->s++;
+      t = rxtree(rp, RX_REP, t, 0);
+      rp->tree[t].min = c == '+';
+      rp->tree[t].max = c == '?' ? 1 : -1;
+    } else if (ere ? c == '{' : c == '\\' && rp->s[1] == '{') {
+      rp->s += 1+!ere;
+      t = rxinterval(rp, t);
+    } else break;
+  }
+
+  return t;
+}
+
+static int rxcat(struct rxparse *rp)
+{
+  int ere = rp->cflags&REG_EXTENDED, t = rxtree(rp, RX_EMPTY, 0, 0),
+    first = 1;
+
+  // first is 1 at the start of a BRE and 2 after a leading ^, where * is
+  // literal
+  while (!rp->fail && *rp->s) {
+    if (ere && (*rp->s == '|' || (*rp->s == ')' && rp->depth))) break;
+    if (!ere && *rp->s == '\\' && (rp->s[1] == ')' || rp->s[1] == '|')) break;
+    if (!ere && first && *rp->s == '*') {
+      rp->s++;
+      t = rxtree(rp, RX_CAT, t, rxliteral(rp, '*'));
+      first = 0;
+    } else {
+      int bol = *rp->s == '^';
+
+      t = rxtree(rp, RX_CAT, t, rxatom(rp, first));
+      first = (first == 1 && bol) ? 2 : 0;
+    }
+  }
+
+  return t;
+}
+
+static int rxalt(struct rxparse *rp)
+{
+  int t = rxcat(rp);
+
+  while (!rp->fail && *rp->s) {
+    if ((rp->cflags&REG_EXTENDED) && *rp->s == '|') rp->s++;
+    else if (!(rp->cflags&REG_EXTENDED) && !strncmp(rp->s, "\\|", 2))
+      return rp->fail++;
+    else break;
+    t = rxtree(rp, RX_ALT, t, rxcat(rp));
+  }
+
+  return t;
+}
+
+static int rxnode(struct dfa *d, int op, int next, int alt)
+{
+  if (d->nnode == RX_MAXNODE) return -1;
+  if (!(d->nnode&255))
+    d->node = xrealloc(d->node, (d->nnode+256)*sizeof(*d->node));
+  d->node[d->nnode].op = op;
+  d->node[d->nnode].next = next;
+  d->node[d->nnode].alt = alt;
+
+  return d->nnode++;
+}
+
+// Compile tree t into NFA nodes that continue to node next, backwards so
+// nothing needs patching. Returns the first node, or -1 if too big.
+static int rxcompile(struct dfa *d, struct rxtree *tree, int t, int next)
+{
+  struct rxtree *tt = tree+t;
+  int i, n;
+
+  if (next<0) return -1;
+  switch (tt->op) {
+  case RX_SET: return rxnode(d, RX_SET, next, tt->a);
+  case RX_CAT:
+    return rxcompile(d, tree, tt->a, rxcompile(d, tree, tt->b, next));
+  case RX_ALT:
+    if ((i = rxcompile(d, tree, tt->a, next))<0) return -1;
+    if ((n = rxcompile(d, tree, tt->b, next))<0) return -1;
+    return rxnode(d, RX_ALT, i, n);
+  case RX_BOL: case RX_EOL: return rxnode(d, tt->op, next, 0);
+  case RX_EMPTY: return next;
+  }
+
+  // a{min,max} is min copies of a then max-min nested optional ones, or a*
+  if (tt->max<0) {
+    if ((n = rxnode(d, RX_ALT, 0, next))<0) return -1;
+    if ((i = rxcompile(d, tree, tt->a, n))<0) return -1;
+    d->node[n].next = i;
+    next = n;
+  } else for (i = tt->min; i<tt->max; i++) {
+    if ((n = rxcompile(d, tree, tt->a, next))<0) return -1;
+    next = rxnode(d, RX_ALT, n, next);
+  }
+  for (i = 0; i<tt->min; i++) next = rxcompile(d, tree, tt->a, next);
+
+  return next;
+}
+
+// Add node n and everything it reaches without consuming input to the
+// work list. SET, MATCH and unsatisfied EOL nodes go in a state's set.
+static void rxclose(struct dfa *d, int n, int bol, int eol, int *len)
+{
+  int sp = 0;
+
+  d->stack[sp++] = n;
+  while (sp) {
+    n = d->stack[--sp];
+    if (d->mark[n] == d->gen) continue;
+    d->mark[n] = d->gen;
+    switch (d->node[n].op) {
+    case RX_ALT:
+      d->stack[sp++] = d->node[n].alt;
+      d->stack[sp++] = d->node[n].next;
+      break;
+    case RX_BOL: if (bol) d->stack[sp++] = d->node[n].next; break;
+    case RX_EMPTY: d->stack[sp++] = d->node[n].next; break;
+    default:
+      if (eol && d->node[n].op == RX_EOL) d->stack[sp++] = d->node[n].next;
+      else d->work[(*len)++] = n;
+    }
+  }
+}
+
+static int rxcmp(const void *a, const void *b)
+{
+  return *(int *)a-*(int *)b;
+}
+
+static void rxflush(struct dfa *d)
+{
+  struct rxstate *st, *next;
+  int i;
+
+  for (i = 0; i<ARRAY_LEN(d->hash); i++) {
+    for (st = d->hash[i]; st; st = next) {
+      next = st->chain;
+      free(st->set);
+      free(st);
+    }
+    d->hash[i] = 0;
+  }
+  memset(d->starts, 0, sizeof(d->starts));
+  d->nstate = d->memory = 0;
+  d->flushes++;
+}
+
+// Find or make the state for the len nodes in d->work
+static struct rxstate *rxstate(struct dfa *d, int len, int bol, int unanch)
+{
+  struct rxstate *st;
+  unsigned hash = 2166136261u*(1+bol+2*unanch);
+  int i, match, size;
+
+  qsort(d->work, len, sizeof(int), rxcmp);
+  for (i = 0; i<len; i++) hash = (hash^d->work[i])*16777619;
+  for (st = d->hash[hash&255]; st; st = st->chain)
+    if (st->hash == hash && st->len == len && st->bol == bol
+      && st->unanch == unanch && !memcmp(st->set, d->work, len*sizeof(int)))
+        return st;
+
+  size = sizeof(*st)+d->ncls*sizeof(st);
+  if (d->memory+size+len*sizeof(int) > RX_MAXMEM) {
+    // Too many states: start over, keeping only this one. Callers must not
+    // hold on to other states across a call that may make one.
+    int *save = xmemdup(d->work, len*sizeof(int));
+
+    rxflush(d);
+    memcpy(d->work, save, len*sizeof(int));
+    free(save);
+  }
+  st = xzalloc(size);
+  st->hash = hash;
+  st->len = len;
+  st->bol = bol;
+  st->unanch = unanch;
+  st->set = xmemdup(d->work, len*sizeof(int));
+  st->chain = d->hash[hash&255];
+  d->hash[hash&255] = st;
+  d->memory += size+len*sizeof(int);
+  d->nstate++;
+
+  // Could this state match at end of line, and can it never match again?
+  for (i = match = 0; i<len; i++) match |= d->node[st->set[i]].op == RX_CAT;
+  st->accept = st->accepteol = match;
+  if (!match) {
+    d->gen++;
+    for (i = size = 0; i<len; i++) rxclose(d, st->set[i], bol, 1, &size);
+    for (i = 0; i<size; i++) st->accepteol |= d->node[d->work[i]].op == RX_CAT;
+  }
+  if (!len) {
+    if (!unanch) st->dead = 1;
+    else if (!(d->cflags&REG_NEWLINE)) {
+      d->gen++;
+      size = 0;
+      rxclose(d, d->start, 0, 0, &size);
+      st->dead = !size;
+    }
+  }
+
+  return st;
+}
+
+static struct rxstate *rxstart(struct dfa *d, int bol, int unanch)
+{
+  struct rxstate **st = d->starts+bol+2*unanch;
+  int len = 0;
+
+  if (!*st) {
+    d->gen++;
+    rxclose(d, d->start, bol, 0, &len);
+    *st = rxstate(d, len, bol, unanch);
+  }
+
+  return *st;
+}
+
+// Work out (and remember) where st goes on byte c
+static struct rxstate *rxstep(struct dfa *d, struct rxstate *st, int c)
+{
+  struct rxstate *next;
+  int i, n, len = 0, nl = c == '\n' && (d->cflags&REG_NEWLINE), *src = st->set,
+    srclen = st->len, *copy = 0;
+
+  // Before a newline, $ holds
+  if (nl) {
+    d->gen++;
+    for (i = 0; i<st->len; i++) rxclose(d, st->set[i], st->bol, 1, &len);
+    src = copy = xmemdup(d->work, len*sizeof(int));
+    srclen = len;
+    len = 0;
+  }
+  d->gen++;
+  for (i = 0; i<srclen; i++) {
+    n = src[i];
+    if (d->node[n].op == RX_SET && (d->sets[d->node[n].alt][c>>3]&(1<<(c&7))))
+      rxclose(d, d->node[n].next, nl, 0, &len);
+  }
+  if (st->unanch) rxclose(d, d->start, nl, 0, &len);
+  free(copy);
+
+  // If this flushes the cache st is gone, and there's nothing to update.
+  n = d->flushes;
+  next = rxstate(d, len, nl, st->unanch);
+  if (n == d->flushes) st->next[d->cls[c]] = next;
+
+  return next;
+}
+
+// Collect the literal text every match starts with
+static int rxprefix(struct rxparse *rp, int t, char *buf, unsigned *len)
+{
+  struct rxtree *tt = rp->tree+t;
+  unsigned char *set;
+  int i, c = -1;
+
+  switch (tt->op) {
+  case RX_EMPTY: return 0;
+  case RX_BOL: return !!*len;
+  case RX_CAT:
+    return rxprefix(rp, tt->a, buf, len) || rxprefix(rp, tt->b, buf, len);
+  case RX_SET:
+    set = rp->sets[tt->a];
+    for (i = 0; i<256; i++) if (set[i>>3]&(1<<(i&7))) {
+      if (c != -1) return 1;
+      c = i;
+    }
+    if (c == -1) return 1;
+    buf[(*len)++] = c;
+    return *len == 255;
+  }
+
+  return 1;
+}
+
+static void rxscratch(struct dfa *d)
+{
+  // A node is pushed at most once for each edge into it
+  d->stack = xmalloc((4*d->nnode+2)*sizeof(int));
+  d->work = d->stack+2*d->nnode+2;
+  d->mark = d->work+d->nnode;
+  memset(d->mark, 0, d->nnode*sizeof(int));
+}
+
+static unsigned rxhash(regex_t *preg)
+{
+  unsigned char *p = (void *)preg;
+  unsigned h = 2166136261u, i;
+
+  for (i = 0; i<sizeof(*preg); i++) h = (h^p[i])*16777619;
+
+  return h;
+}
+
+// The DFA for a regex_t xregcomp() compiled, found by its contents so
+// copies of the regex_t find it too.
+static struct dfa **dfa_find(regex_t *preg)
+{
+  struct dfa **dd;
+
+  if (!dfasize) return 0;
+  for (dd = dfas+(rxhash(preg)&(dfasize-1)); *dd; dd = &(*dd)->chain)
+    if (!memcmp(&(*dd)->key, preg, sizeof(*preg))) break;
+
+  return dd;
+}
+
+static void dfa_free(struct dfa **dd)
+{
+  struct dfa *d = *dd;
+
+  *dd = d->chain;
+  rxflush(d);
+  free(d->node);
+  free(d->sets);
+  free(d->prefix);
+  free(d->stack);
+  free(d);
+  ndfas--;
+}
+
+// Build a DFA for regex, which regcomp() already accepted into preg.
+void dfa_comp(regex_t *preg, char *regex, int cflags)
+{
+  struct rxparse rp = {0};
+  struct dfa *d = 0, **dd;
+  char prefix[256];
+  unsigned i, j, k, h;
+  int root, match;
+
+  // Drop a stale DFA for a regex_t freed without xregfree().
+  if ((dd = dfa_find(preg)) && *dd) dfa_free(dd);
+
+  rp.s = regex;
+  rp.cflags = cflags;
+  rp.utf8 = MB_CUR_MAX>1;
+  root = rxalt(&rp);
+  if (rp.fail || *rp.s) goto done;
+
+  d = xzalloc(sizeof(*d));
+  d->owner = pthread_self();
+  memcpy(&d->key, preg, sizeof(*preg));
+  d->cflags = cflags;
+  if ((match = rxnode(d, RX_CAT, 0, 0))<0
+    || (d->start = rxcompile(d, rp.tree, root, match))<0)
+  {
+    free(d->node);
+    free(d);
+    goto done;
+  }
+  i = 0;
+  rxprefix(&rp, root, prefix, &i);
+  if ((d->plen = i)) d->prefix = xmemdup(prefix, i);
+
+  d->sets = rp.sets;
+  rp.sets = 0;
+  rxscratch(d);
+
+  // Bytes no set tells apart share a class, but newline is always its own.
+  for (i = 0; i<256; i++) d->cls[i] = i == '\n';
+  d->ncls = 2;
+  for (i = 0; i<rp.nset; i++) {
+    short map[512];
+
+    for (j = 0; j<512; j++) map[j] = -1;
+    for (j = k = 0; j<256; j++) {
+      h = 2*d->cls[j]+!!(d->sets[i][j>>3]&(1<<(j&7)));
+      if (map[h]<0) map[h] = k++;
+      d->cls[j] = map[h];
+    }
+    d->ncls = k;
+  }
+
+  // Keep the table no more than half full
+  if (2*++ndfas>dfasize) {
+    struct dfa **old = dfas, *dd2, *next;
+    unsigned oldsize = dfasize;
+
+    dfasize = dfasize ? 2*dfasize : 16;
+    dfas = xzalloc(dfasize*sizeof(*dfas));
+    for (i = 0; i<oldsize; i++) for (dd2 = old[i]; dd2; dd2 = next) {
+      next = dd2->chain;
+      h = rxhash(&dd2->key)&(dfasize-1);
+      dd2->chain = dfas[h];
+      dfas[h] = dd2;
+    }
+    free(old);
+  }
+  h = rxhash(preg)&(dfasize-1);
+  d->chain = dfas[h];
+  dfas[h] = d;
+
+done:
+  free(rp.tree);
+  free(rp.sets);
+}
+
+// Free the calling thread's copies of DFAs when it exits
+static void dfa_forget(void *list)
+{
+  struct dfa *d, *next;
+
+  for (d = list; d; d = next) {
+    next = d->chain;
+    rxflush(d);
+    free(d->stack);
+    free(d);
+  }
+}
+
+static void dfa_key(void)
+{
+  pthread_key_create(&rxkey, dfa_forget);
+}
+
+// This thread's copy of d, with the same NFA but states of its own
+static struct dfa *dfa_mine(struct dfa *d)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  struct dfa *c, *list;
+
+  pthread_once(&once, dfa_key);
+  for (c = list = pthread_getspecific(rxkey); c; c = c->chain)
+    if (c->orig == d) return c;
+
+  c = xzalloc(sizeof(*c));
+  c->orig = d;
+  c->owner = pthread_self();
+  memcpy(&c->key, &d->key, sizeof(c->key));
+  c->cflags = d->cflags;
+  c->nnode = d->nnode;
+  c->start = d->start;
+  c->ncls = d->ncls;
+  c->node = d->node;
+  c->sets = d->sets;
+  memcpy(c->cls, d->cls, sizeof(c->cls));
+  c->prefix = d->prefix;
+  c->plen = d->plen;
+  rxscratch(c);
+  c->chain = list;
+  pthread_setspecific(rxkey, c);
+
+  return c;
+}
+
+// Forget the DFA for preg, then regfree() it.
+void xregfree(regex_t *preg)
+{
+  struct dfa **dd = dfa_find(preg);
+
+  if (dd && *dd) dfa_free(dd);
+  regfree(preg);
+}
+
+// Run the DFA from pos. Returns whether it matched, with the end of the
+// first match (or the longest, if longest) in *end, or -1 if it used up
+// *work bytes first.
+static int rxscan(struct dfa *d, char *s, long pos, long len, int unanch,
+  int eflags, int longest, long *end, long *work)
+{
+  struct rxstate *st;
+  int nl = d->cflags&REG_NEWLINE, found = 0;
+  long i;
+  char *p;
+
+  st = rxstart(d, pos ? nl && s[pos-1] == '\n' : !(eflags&REG_NOTBOL), unanch);
+  for (i = pos;; i++) {
+    if (st->accept || (st->accepteol && (i == len ? !(eflags&REG_NOTEOL)
+      : nl && s[i] == '\n')))
+    {
+      *end = i;
+      if (!longest) return 1;
+      found = 1;
+    }
+    if (i == len || st->dead) break;
+    if (work && --*work<0) return -1;
+
+    // Back to looking for a start: skip to the next one the prefix allows.
+    if (d->plen && st == d->starts[st->bol+2] && st->unanch) {
+      if (!(p = memmem(s+i, len-i, d->prefix, d->plen))) break;
+      if (p != s+i) {
+        i = p-s;
+        st = rxstart(d, nl && s[i-1] == '\n', 1);
+      }
+    }
+    st = st->next[d->cls[(unsigned char)s[i]]]
+      ? : rxstep(d, st, (unsigned char)s[i]);
+  }
+
+  return found;
+}
+
+// regexec() for a regex xregcomp() compiled, on len bytes of s. Returns -1
+// when libc has to do it.
+int dfa_exec(regex_t *preg, char *s, long len, int nmatch, regmatch_t *pmatch,
+  int eflags)
+{
+  struct dfa **dd = dfa_find(preg), *d;
+  long first, start, end, work;
+  char *p;
+  int i, rc;
+
+  if (!dd || !(d = *dd)) return -1;
+  if (!pthread_equal(d->owner, pthread_self())) d = dfa_mine(d);
+  if ((d->cflags&REG_NOSUB)) nmatch = 0;
+  if (!rxscan(d, s, 0, len, 1, eflags, 0, &first, 0)) return REG_NOMATCH;
+  if (!nmatch) return 0;
+  if (nmatch>1 && preg->re_nsub) return -1;
+
+  // The leftmost match starts at or before the end of the first one found.
+  // Trying each start can rescan the same bytes over and over (x*y against
+  // xxx...xzy), so hand lines that need more than a few passes to libc.
+  work = 4*len+256;
+  for (start = 0; start<=first; start++) {
+    if (d->plen) {
+      if (!(p = memmem(s+start, len-start, d->prefix, d->plen))) break;
+      start = p-s;
+    }
+    if ((rc = rxscan(d, s, start, len, 0, eflags, 1, &end, &work))<0) break;
+    if (rc) {
+      pmatch[0].rm_so = start;
+      pmatch[0].rm_eo = end;
+      for (i = 1; i<nmatch; i++) pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
@@ -969,10 +969,13 @@ void xregcomp(regex_t *preg, char *regex, int cflags)
     cflags |= REG_EXTENDED;
   }
 
+  // Zeroed so copies of the same compiled regex compare equal for dfa_exec()
+  memset(preg, 0, sizeof(*preg));
   if ((rc = regcomp(preg, regex, cflags))) {
     regerror(rc, preg, libbuf, sizeof(libbuf));
     error_exit("bad regex '%s': %s", regex, libbuf);
   }
+  dfa_comp(preg, regex, cflags);
 }
 
 char *xtzset(char *new)
@@ -34,8 +34,7 @@ static void do_shuf_line(char **pline, long len)
   if (!pline) return;
   if (!(TT.count&255))
     TT.lines = xrealloc(TT.lines, sizeof(void *)*(TT.count+256));
-  TT.lines[TT.count++] = *pline; // TODO: repack?
-  *pline = 0;
+  TT.lines[TT.count++] = xmemdup(*pline, len+1); // TODO: repack?
 }
 
 static void do_shuf(int fd, char *name)
@@ -22,10 +22,8 @@ GLOBALS(
 
 static void do_tac(char **pline, long len)
 {
-  if (pline) {
-    dlist_add(&TT.dl, *pline);
-    *pline = 0;
-  } else while (TT.dl) {
+  if (pline) dlist_add(&TT.dl, xmemdup(*pline, len+1));
+  else while (TT.dl) {
     struct double_list *dl = dlist_lpop(&TT.dl);
 
     xprintf("%s", dl->data);
@@ -2575,7 +2575,7 @@ static void rx_zvalue_compile(regex_t **rx, struct zvalue *pat)
 
 static void rx_zvalue_free(regex_t *rx, struct zvalue *pat)
 {
-  if (!IS_RX(pat) || rx != pat->rx) regfree(rx);
+  if (!IS_RX(pat) || rx != pat->rx) xregfree(rx);
 }
 
 // Used by the match/not match ops (~ !~) and implicit $0 match (/regex/)
@@ -2585,7 +2585,8 @@ static int match(struct zvalue *zvsubject, struct zvalue *zvpat)
   regex_t rx, *rxp = &rx;
   val_to_str(zvsubject);
   rx_zvalue_compile(&rxp, zvpat);
-  if ((r = regexec(rxp, zvsubject->vst->str, 0, 0, 0)) != 0) {
+  if ((r = regexec0(rxp, zvsubject->vst->str, zvsubject->vst->size, 0, 0, 0))
+      != 0) {
     if (r != REG_NOMATCH) {
       char errbuf[256];
       regerror(r, &rx, errbuf, sizeof(errbuf));
@@ -2602,7 +2603,7 @@ static int match(struct zvalue *zvsubject, struct zvalue *zvpat)
 static int rx_find(regex_t *rx, char *s, regoff_t *start, regoff_t *end, int eflags)
 {
   regmatch_t matches[1];
-  int r = regexec(rx, s, 1, matches, eflags);
+  int r = regexec0(rx, s, strlen(s), 1, matches, eflags);
   if (r == REG_NOMATCH) return r;
   if (r) FATAL("regexec error");  // TODO ? use regerr() to meaningful msg
   *start = matches[0].rm_so;
@@ -2659,7 +2660,7 @@ static regex_t *rx_fs_prep(char *fs)
   if (!strcmp(fs, TT.fs_last)) return &TT.rx_last;
   if (strlen(fs) >= FS_MAX) FATAL("FS too long");
   strcpy(TT.fs_last, fs);
-  regfree(&TT.rx_last);
+  xregfree(&TT.rx_last);
   xregcomp(&TT.rx_last, fmt_one_char_fs(fs), REG_EXTENDED);
   return &TT.rx_last;
 }
@@ -3403,7 +3404,7 @@ static ssize_t getrec_f(struct zfile *zfp)
       break;
     }
   }
-  regfree(rsrxp);
+  xregfree(rsrxp);
   return ret;
 }
 
@@ -4486,7 +4487,7 @@ static void free_literal_regex(void)
 {
   int len = zlist_len(&TT.literals);
   for (int k = 1; k < len; k++)
-    if (IS_RX(&LITERAL[k])) regfree(LITERAL[k].rx);
+    if (IS_RX(&LITERAL[k])) xregfree(LITERAL[k].rx);
 }
 
 static void run(int optind, int argc, char **argv, char *sepstring,
@@ -4509,9 +4510,9 @@ static void run(int optind, int argc, char **argv, char *sepstring,
   if (r != tkexit)
     if (TT.cgl.first_recrule) run_files(&status);
   if (TT.cgl.first_end) r = interp(TT.cgl.first_end, &status);
-  regfree(&TT.rx_printf_fmt);
-  regfree(&TT.rx_default);
-  regfree(&TT.rx_last);
+  xregfree(&TT.rx_printf_fmt);
+  xregfree(&TT.rx_default);
+  xregfree(&TT.rx_last);
   free_literal_regex();
   close_file(0);    // close all files
   if (status >= 0) exit(status);
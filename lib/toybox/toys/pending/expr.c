@@ -104,7 +104,7 @@ static void re(char *target, char *pattern, struct value *ret)
 
   xregcomp(&pat, pattern, 0);
   // must match at pos 0
-  if (!regexec(&pat, target, 2, m, 0) && !m[0].rm_so) {
+  if (!regexec0(&pat, target, strlen(target), 2, m, 0) && !m[0].rm_so) {
     // Return first parenthesized subexpression as string, or length of match
     if (pat.re_nsub>0) {
       ret->s = xmprintf("%.*s", (int)(m[1].rm_eo-m[1].rm_so), target+m[1].rm_so);
@@ -115,7 +115,7 @@ static void re(char *target, char *pattern, struct value *ret)
     if (pat.re_nsub>0) ret->s = "";
     else assign_int(ret, 0);
   }
-  regfree(&pat);
+  xregfree(&pat);
 }
 
 // 4 different signatures of operators.  S = string, I = int, SI = string or
@@ -192,7 +192,7 @@ void man_main(void)
       closedir(dp);
       free(d);
     }
-    return regfree(&TT.reg);
+    return xregfree(&TT.reg);
   }
 
   if (!toys.optc) help_exit("which page?");
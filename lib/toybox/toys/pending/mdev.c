@@ -122,7 +122,7 @@ static void make_device(char *path)
               // Is this it?
               xregcomp(&match, regex, REG_EXTENDED);
               result=regexec(&match, device_name, 1, &off, 0);
-              regfree(&match);
+              xregfree(&match);
               free(regex);
 
               // If not this device, skip rest of line
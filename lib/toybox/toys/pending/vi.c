@@ -1400,7 +1400,7 @@ static int run_ex_cmd(char *cmd)
       // Reset Frame
       TT.vi_mov_flag |= 0x30000000;
 gcleanup:
-      regfree(&rgxc); free(rgx);
+      xregfree(&rgxc); free(rgx);
     }
 
     // Line Ranges
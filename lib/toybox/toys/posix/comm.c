@@ -39,15 +39,23 @@ static void writeline(const char *line, int col)
   puts(line);
 }
 
+// Next line without its newline, good until the next call on this file.
+static char *nextline(struct linebuf *lb)
+{
+  long len;
+
+  return chomp(linebuf_next(lb, &len));
+}
+
 void comm_main(void)
 {
-  FILE *file[2];
+  struct linebuf lb[2];
   char *line[2];
   int i = 0;
 
   for (i = 0; i<2; i++) {
-    file[i] = strcmp(toys.optargs[i], "-")?xfopen(toys.optargs[i], "r"):stdin;
-    line[i] = xgetline(file[i]);
+    linebuf_init(lb+i, xopenro(toys.optargs[i]), '\n');
+    line[i] = nextline(lb+i);
   }
 
   if (toys.optflags == 7) return;
@@ -57,24 +65,22 @@ void comm_main(void)
 
     if (!order) {
       writeline(line[0], 2);
-      for (i = 0; i < 2; i++) {
-        free(line[i]);
-        line[i] = xgetline(file[i]);
-      }
+      for (i = 0; i < 2; i++) line[i] = nextline(lb+i);
     } else {
       i = order>0;
       writeline(line[i], i);
-      free(line[i]);
-      line[i] = xgetline(file[i]);
+      line[i] = nextline(lb+i);
     }
   }
 
   // Print rest of the longer file.
   for (i = line[0] ? 0 : 1; line[i];) {
     writeline(line[i], i);
-    free(line[i]);
-    line[i] = xgetline(file[i]);
+    line[i] = nextline(lb+i);
   }
 
-  if (CFG_TOYBOX_FREE) fclose(file[0]), fclose(file[1]);
+  if (CFG_TOYBOX_FREE) for (i = 0; i<2; i++) {
+    if (lb[i].fd) close(lb[i].fd);
+    linebuf_free(lb+i);
+  }
 }
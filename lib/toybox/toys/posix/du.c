@@ -156,10 +156,11 @@ void du_main(void)
 {
   char *noargs[] = {".", 0}, **args;
 
-  // Loop over command line arguments, recursing through children
+  // Loop over command line arguments, recursing through children. Other
+  // threads read and stat directories ahead, the sums happen here in order.
   for (args = toys.optc ? toys.optargs : noargs; *args; args++)
-    dirtree_flagread(*args, DIRTREE_SYMFOLLOW*!!(toys.optflags&(FLAG_H|FLAG_L)),
-      do_du);
+    dirtree_parallel(*args, DIRTREE_ORDERED
+      |DIRTREE_SYMFOLLOW*!!(toys.optflags&(FLAG_H|FLAG_L)), do_du);
   if (FLAG(c)) print(FLAG(b) ? TT.total : TT.total*512, 0);
 
   if (CFG_TOYBOX_FREE) seen_inode(TT.inodes, 0);
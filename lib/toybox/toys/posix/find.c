@@ -213,9 +213,10 @@ static int do_find(struct dirtree *new)
 {
   int pcount = 0, print = 0, not = 0, active = !!new, test = active, recurse;
   struct double_list *argdata = TT.argdata;
-  char *s, **ss, *arg;
+  char *s, **ss, *arg, stack[4096];
 
-  recurse = DIRTREE_STATLESS|DIRTREE_COMEAGAIN|DIRTREE_SYMFOLLOW*FLAG(L);
+  recurse = DIRTREE_STATLESS|DIRTREE_COMEAGAIN|DIRTREE_SYMFOLLOW*FLAG(L)
+    |DIRTREE_NOSTAT;
 
   // skip . and .. below topdir, handle -xdev and -depth
   if (new) {
@@ -260,7 +261,7 @@ static int do_find(struct dirtree *new)
     }
   }
 
-  // pcount: parentheses stack depth (using toybuf bytes, 4096 max depth)
+  // pcount: parentheses stack depth (4096 max depth)
   // test: result of most recent test
   // active: if 0 don't perform tests
   // not: a pending ! applies to this test (only set if performing tests)
@@ -271,7 +272,7 @@ static int do_find(struct dirtree *new)
 
     // if (!new) perform one-time setup, if (check) perform test
 
-    // handle ! ( ) using toybuf as a stack
+    // handle ! ( ) using stack
     if (*s != '-') {
       if (s[1]) goto error;
 
@@ -279,12 +280,12 @@ static int do_find(struct dirtree *new)
         // Don't invert if we're not making a decision
         if (check) not = !not;
 
-      // Save old "not" and "active" on toybuf stack.
+      // Save old "not" and "active" on stack.
       // Deactivate this parenthetical if !test
       // Note: test value should never change while !active
       } else if (*s == '(') {
-        if (pcount == sizeof(toybuf)) goto error;
-        toybuf[pcount++] = not+(active<<1);
+        if (pcount == sizeof(stack)) goto error;
+        stack[pcount++] = not+(active<<1);
         if (!check) active = 0;
         not = 0;
 
@@ -292,14 +293,34 @@ static int do_find(struct dirtree *new)
       } else if (*s == ')') {
         if (--pcount < 0) goto error;
         // Pop active state, apply deferred not (which was only set if checking)
-        active = (toybuf[pcount]>>1)&1;
-        if (active && (toybuf[pcount]&1)) test = !test;
+        active = (stack[pcount]>>1)&1;
+        if (active && (stack[pcount]&1)) test = !test;
         not = 0;
       } else goto error;
 
       continue;
     } else s++;
 
+    // Files under a directory only have their type until a test needs more
+    if (check) {
+      char *typeonly[] = {"name", "iname", "path", "ipath", "type", "print",
+        "print0", "prune", "o", "or", "a", "and", "not", "true", "false",
+        "quit", "mindepth", "maxdepth", "depth", "d", "exec", "execdir", "ok",
+        "okdir", "delete", "wholename", "iwholename", "lname", "ilname",
+        "executable", "readable", "noleaf", "xdev"};
+      int i;
+
+      for (i = 0; i<ARRAY_LEN(typeonly) && strcmp(s, typeonly[i]); i++);
+      if (i == ARRAY_LEN(typeonly) && dirtree_stat(new)) {
+        if (errno != ENOENT) {
+          perror_msg("'%s'", s = dirtree_path(new, 0));
+          free(s);
+        }
+
+        return 0;
+      }
+    }
+
     if (!strcmp(s, "xdev")) TT.xdev = 1;
     else if (!strcmp(s, "delete")) {
       // Delete forces depth first
@@ -692,8 +713,9 @@ error:
 
 void find_main(void)
 {
-  int i, len;
-  char **ss = (char *[]){"."};
+  int i, len, serial = 0;
+  char **ss = (char *[]){"."}, **tt, *order[] = {"exec", "execdir", "ok",
+    "okdir", "delete", "quit", "printf", "context", "nouser", "nogroup"};
 
   TT.topdir = -1;
   TT.max_bytes = sysconf(_SC_ARG_MAX) - environ_bytes();
@@ -711,9 +733,14 @@ void find_main(void)
   TT.now = time(0);
   do_find(0);
 
+  // Search several directories at once, unless an action cares about order
+  // (or about not running in more than one thread).
+  for (tt = TT.filter; *tt; tt++) if (**tt == '-')
+    for (i = 0; i<ARRAY_LEN(order); i++) serial |= !strcmp(*tt+1, order[i]);
+
   // Loop through paths
   for (i = 0; i < len; i++)
-    dirtree_flagread(ss[i],
+    (serial ? dirtree_flagread : dirtree_parallel)(ss[i],
       DIRTREE_STATLESS|(DIRTREE_SYMFOLLOW*!!(toys.optflags&(FLAG_H|FLAG_L))),
       do_find);
 
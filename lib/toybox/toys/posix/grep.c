@@ -69,15 +69,25 @@ GLOBALS(
   struct double_list *reg;
   int found, tried, delim;
   struct arg_list **fixed;
+  struct grep_ac *ac;
 )
 
 struct reg {
   struct reg *next, *prev;
-  int rc;
+  int rc, len;
+  char *lit;
   regex_t r;
   regmatch_t m;
 };
 
+// Aho-Corasick automaton for the plain literal patterns. State 0 is the root,
+// whose transitions live in root[], other states' in a hash of state*256+byte.
+struct grep_ac {
+  unsigned *fail, *dict, *len, *key, *val, root[256];
+  unsigned states, bits, maxlen;
+  int first;
+};
+
 static void numdash(long num, char dash)
 {
   printf("%s%ld%s%c", TT.green, num, TT.cyan, dash);
@@ -110,14 +120,164 @@ static int matchw(char *line, char *start, long so, long eo)
   return 1;
 }
 
+static unsigned *ac_slot(struct grep_ac *ac, unsigned key)
+{
+  unsigned mask = (1<<ac->bits)-1, i = (key*0x9E3779B1u)>>(32-ac->bits);
+
+  while (ac->key[i] && ac->key[i]!=key) i = (i+1)&mask;
+
+  return ac->key+i;
+}
+
+static unsigned ac_child(struct grep_ac *ac, unsigned state, int c)
+{
+  unsigned *slot;
+
+  if (!state) return ac->root[c];
+  slot = ac_slot(ac, state*256+c);
+
+  return *slot ? ac->val[slot-ac->key] : 0;
+}
+
+// Build automaton from the NULL-terminated list of patterns, with their total
+// length in bytes. Case insensitive patterns are upper cased, as is input.
+static struct grep_ac *ac_build(char **pat, unsigned total)
+{
+  struct grep_ac *ac = xzalloc(sizeof(struct grep_ac));
+  unsigned *parent, *bydepth, *count, s, t, i, c;
+  unsigned char *byte, *p;
+
+  if (total >= 1<<24) error_exit("too many patterns");
+  for (ac->bits = 4; 1<<ac->bits < 2*total; ac->bits++);
+  ac->key = xzalloc(sizeof(unsigned)<<ac->bits);
+  ac->val = xmalloc(sizeof(unsigned)<<ac->bits);
+  ac->fail = xzalloc(sizeof(unsigned)*(total+1));
+  ac->dict = xzalloc(sizeof(unsigned)*(total+1));
+  ac->len = xzalloc(sizeof(unsigned)*(total+1));
+  parent = xzalloc(sizeof(unsigned)*(total+1));
+  byte = xzalloc(total+1);
+  ac->states = 1;
+  ac->first = -1;
+
+  // Insert patterns into a trie, len is the depth of terminal states
+  for (; *pat; pat++) {
+    for (s = 0, p = (void *)*pat; *p; p++) {
+      c = FLAG(i) ? toupper(*p) : *p;
+      if (!(t = ac_child(ac, s, c))) {
+        t = ac->states++;
+        parent[t] = s;
+        byte[t] = c;
+        if (!s) ac->root[c] = t;
+        else {
+          unsigned *slot = ac_slot(ac, s*256+c);
+
+          *slot = s*256+c;
+          ac->val[slot-ac->key] = t;
+        }
+      }
+      s = t;
+    }
+    ac->len[s] = p-(unsigned char *)*pat;
+    if (ac->len[s]>ac->maxlen) ac->maxlen = ac->len[s];
+    c = FLAG(i) ? toupper(**pat) : **pat;
+    ac->first = (ac->first==-1 || ac->first==c) ? c : -2;
+  }
+  if (FLAG(i) && isalpha(ac->first)) ac->first = -2;
+
+  // Fail links point to the longest proper suffix that's also a trie state,
+  // dict links to the longest such suffix that ends a pattern. Both need the
+  // shallower states done first, so sort states by depth (parent's depth+1).
+  count = xzalloc(sizeof(unsigned)*(ac->maxlen+2));
+  bydepth = xmalloc(sizeof(unsigned)*ac->states);
+  for (s = 1; s<ac->states; s++) {
+    // Reuse fail[] as depth until the links are calculated
+    ac->fail[s] = ac->fail[parent[s]]+1;
+    count[ac->fail[s]+1]++;
+  }
+  for (i = 1; i<=ac->maxlen; i++) count[i+1] += count[i];
+  for (s = 1; s<ac->states; s++) bydepth[count[ac->fail[s]]++] = s;
+  for (i = 1; i<ac->states; i++) {
+    s = bydepth[i-1];
+    if (!parent[s]) t = 0;
+    else {
+      for (t = ac->fail[parent[s]]; t && !ac_child(ac, t, byte[s]); t = ac->fail[t]);
+      t = ac_child(ac, t, byte[s]);
+    }
+    ac->fail[s] = t;
+    ac->dict[s] = ac->len[t] ? t : ac->dict[t];
+  }
+  free(count);
+  free(bydepth);
+  free(parent);
+  free(byte);
+
+  return ac;
+}
+
+// Find leftmost longest match in len bytes at start, passing -w checks.
+static int ac_match(char *line, char *start, long len, regmatch_t *mm)
+{
+  struct grep_ac *ac = TT.ac;
+  unsigned char *s = (void *)start;
+  unsigned state = 0, t;
+  long ii, so, best = -1;
+  int c;
+
+  for (ii = 0; ii<len; ii++) {
+    // Nothing ending later can start earlier than (or at) the best match
+    if (best>=0 && ii+1-ac->maxlen>best) break;
+
+    // Skip ahead to candidate first bytes when not part way through a match
+    if (!state) {
+      if (ac->first>=0) {
+        unsigned char *next = memchr(s+ii, ac->first, len-ii);
+
+        if (!next) break;
+        ii = next-s;
+      } else if (FLAG(i)) while (ii<len && !ac->root[toupper(s[ii])]) ii++;
+      else while (ii<len && !ac->root[s[ii]]) ii++;
+      if (ii==len || (best>=0 && ii+1-ac->maxlen>best)) break;
+    }
+
+    c = FLAG(i) ? toupper(s[ii]) : s[ii];
+    while (state && !(t = ac_child(ac, state, c))) state = ac->fail[state];
+    if (!state) t = ac->root[c];
+    state = t;
+
+    // Patterns ending here, longest first, so first to pass -w is best
+    for (t = ac->len[state] ? state : ac->dict[state]; t; t = ac->dict[t]) {
+      if ((so = ii+1-ac->len[t])>best && best>=0) break;
+      if (!matchw(line, start, so, ii+1)) continue;
+      best = so;
+      mm->rm_so = so;
+      mm->rm_eo = ii+1;
+      break;
+    }
+  }
+
+  return best>=0;
+}
+
+// Report an error about name under the stdout lock each file's output is
+// printed under, after flushing that output, so with -r in several threads
+// the message can't land in the middle of another file's lines.
+static void grep_perror(char *name)
+{
+  flockfile(stdout);
+  fflush(stdout);
+  perror_msg_raw(name);
+  funlockfile(stdout);
+}
+
 // Show matches in one file
 static void do_grep(int fd, char *name)
 {
   long lcount = 0, mcount = 0, offset = 0, after = 0, before = 0, new = 1;
   struct double_list *dlb = 0;
-  char *bars = 0;
-  FILE *file;
-  int bin = 0;
+  struct reg *regs = 0, **rr = &regs, *shoe;
+  char *bars = 0, *buf, *dl;
+  size_t size = 65536, pos = 0, end = 0;
+  int bin = 0, eof = 0, skip, locked = 0;
 
   if (!FLAG(r)) TT.tried++;
   if (!fd) name = "(standard input)";
@@ -142,38 +302,78 @@ static void do_grep(int fd, char *name)
     if (bin && FLAG(I)) return;
   }
 
-  if (!(file = fdopen(fd, "r"))) return perror_msg_raw(name);
+  // When only the automaton can match, search the whole buffer with it and
+  // jump straight to lines with a candidate match, skipping the rest.
+  skip = TT.ac && !TT.e && !TT.reg && !FLAG(v) && !TT.A && !TT.B;
+  *(buf = xmalloc(size+1)) = 0;
+
+  // Each regex remembers its last match, so -r searching files in several
+  // threads at once needs a copy per file.
+  for (shoe = (void *)TT.reg; shoe; shoe = shoe->next) {
+    *rr = xmemdup(shoe, sizeof(*shoe));
+    rr = &(*rr)->next;
+  }
 
   // Loop through lines of input
   for (;;) {
-    char *line = 0, *start, *ss, *pp;
-    struct reg *shoe;
+    char *line, *start, *ss, *pp;
     size_t ulen;
     long len;
     int matched = 0, rc = 1, move = 0, ii;
 
-    // get next line, check and trim delimiter
+    // get next line from the buffer, refilling it as needed
+    for (;;) {
+      if (skip && pos<end) {
+        regmatch_t m;
+
+        ss = buf+end;
+        if (ac_match(buf+pos, buf+pos, end-pos, &m)) ss = buf+pos+m.rm_so;
+        while ((dl = memchr(buf+pos, TT.delim, ss-buf-pos))) {
+          lcount++;
+          offset += dl+1-buf-pos;
+          pos = dl+1-buf;
+        }
+      }
+      if ((dl = memchr(buf+pos, TT.delim, end-pos)) || eof) break;
+      if (pos) memmove(buf, buf+pos, end -= pos);
+      pos = 0;
+      if (end == size) buf = xrealloc(buf, (size *= 2)+1);
+      if (1>(len = read(fd, buf+end, size-end))) {
+        if (len) grep_perror(name);
+        eof++;
+      } else end += len;
+      buf[end] = 0;
+    }
+    if (pos == end) break;
+    if (!dl) dl = buf+end;
     lcount++;
-    errno = 0;
-    ulen = len = getdelim(&line, &ulen, TT.delim, file);
-    if (len == -1 && errno) perror_msg_raw(name);
-    if (len<1) break;
-    if (line[ulen-1] == TT.delim) line[--ulen] = 0;
+    line = buf+pos;
+    ulen = dl-line;
+    len = ulen+(dl != buf+end);
+    pos += len;
+    *dl = 0;
 
     // Prepare for next line
     start = line;
-    for (shoe = (void *)TT.reg; shoe; shoe = shoe->next) shoe->rc = 0;
+    for (shoe = regs; shoe; shoe = shoe->next) {
+      // Skip regexes whose required literal isn't in the line at all
+      shoe->rc = shoe->lit && !memmem(line, ulen, shoe->lit, shoe->len);
+      if (shoe->rc) shoe->m.rm_so = shoe->m.rm_eo = 0;
+    }
 
     // Loop to handle multiple matches in same line
     if (new) do {
-      regmatch_t *mm = (void *)toybuf;
+      regmatch_t m, *mm = &m;
       struct arg_list *seek;
 
       mm->rm_so = mm->rm_eo = 0;
       rc = 1;
 
-      // Handle "fixed" (literal) matches (if any)
-      if (TT.e) for (ss = start; ss-line<=ulen; ss++) {
+      // Handle "fixed" (literal) matches (if any), any from the automaton
+      // only losing to an earlier or longer match in the buckets.
+      if (TT.ac && ac_match(line, start, ulen-(start-line), mm)) rc = 0;
+      if (TT.e) for (ss = start; ss-line<=ulen && (rc || ss-start<=mm->rm_so);
+          ss++) {
         ii = FLAG(i) ? toupper(*ss) : *ss;
         for (seek = TT.fixed[ii]; seek; seek = seek->next) {
           if (*(pp = seek->arg)=='^' && !FLAG(F)) {
@@ -191,8 +391,9 @@ static void do_grep(int fd, char *name)
             } else if (pp[ii]!=ss[ii]) break;
           }
           if (pp[ii] && (pp[ii]!='$' || pp[ii+1] || ss[ii])) continue;
+          if (!rc && ss-start==mm->rm_so && ii<=mm->rm_eo-mm->rm_so) continue;
+          if (!matchw(line, start, ss-start, ss-start+ii)) continue;
           mm->rm_eo = (mm->rm_so = ss-start)+ii;
-          if (!matchw(line, start, mm->rm_so, mm->rm_eo)) continue;
           rc = 0;
 
           goto got;
@@ -202,7 +403,7 @@ static void do_grep(int fd, char *name)
 
 got:
       // Handle regex matches (if any)
-      for (shoe = (void *)TT.reg; shoe; shoe = shoe->next) {
+      for (shoe = regs; shoe; shoe = shoe->next) {
         // Do we need to re-check this regex?
         if (!shoe->rc) {
           shoe->m.rm_so -= move;
@@ -243,6 +444,9 @@ got:
         mm->rm_so = 0;
       } else if (rc) break;
 
+      // Keep a file's output together when other threads are printing too
+      if (!locked++) flockfile(stdout);
+
       // At least one line we didn't print since match while -ABC active
       if (bars) {
         xputs(bars);
@@ -258,9 +462,8 @@ got:
       }
       if (FLAG(L) || FLAG(l)) {
         if (FLAG(l)) xprintf("%s%c", name, '\n'*!FLAG(Z));
-        free(line);
-        fclose(file);
-        return;
+
+        goto done;
       }
 
       if (!FLAG(c)) {
@@ -316,12 +519,11 @@ got:
       if (discard && TT.B) {
         unsigned *uu, ul = (ulen|3)+1;
 
-        line = xrealloc(line, ul+8);
+        line = memcpy(xmalloc(ul+8), line, ulen+1);
         uu = (void *)(line+ul);
         uu[0] = offset-len;
         uu[1] = ulen;
         dlist_add(&dlb, line);
-        line = 0;
         if (++before>TT.B) {
           struct double_list *dl;
 
@@ -335,7 +537,6 @@ got:
       // line (but don't show them now in case that was last match in file)
       if (discard && mcount) bars = "--";
     }
-    free(line);
 
     if (FLAG(m) && mcount >= TT.m) {
       if (!after) break;
@@ -343,12 +544,16 @@ got:
     }
   }
 
+  // -L and -c print for files without a match too
+  if ((FLAG(L) || FLAG(c)) && !locked++) flockfile(stdout);
   if (FLAG(L)) xprintf("%s%c", name, TT.delim);
   else if (FLAG(c)) outline(0, ':', name, mcount, 0, 1);
 
-  // loopfiles will also close the fd, but this frees an (opaque) struct.
-  fclose(file);
+done:
+  if (locked) funlockfile(stdout);
+  free(buf);
   llist_traverse(dlb, llist_free_double);
+  llist_traverse(regs, free);
 }
 
 static int lensort(struct arg_list **a, struct arg_list **b)
@@ -415,8 +620,18 @@ static void parse_regex(void)
     else {
       struct reg *shoe;
 
-      dlist_add_nomalloc(&TT.reg, (void *)(shoe = xmalloc(sizeof(struct reg))));
+      dlist_add_nomalloc(&TT.reg, (void *)(shoe = xzalloc(sizeof(struct reg))));
       xregcomp(&shoe->r, (*last)->arg, REG_EXTENDED*FLAG(E)|REG_ICASE*FLAG(i));
+
+      // Any match must contain the literal text the regex starts with, minus
+      // the last character if something after it could make it optional.
+      s = (*last)->arg;
+      if (!FLAG(i) && !strchr(s, '|')) {
+        s += *s=='^';
+        for (ss = s; *ss && !strchr(special, *ss); ss++);
+        if (*ss && strchr("\\*+?{", *ss) && ss>s) ss--;
+        if (ss-s>1) shoe->lit = xstrndup(s, shoe->len = ss-s);
+      }
       al = *last;
       *last = (*last)->next;
       free(al);
@@ -424,6 +639,45 @@ static void parse_regex(void)
   }
   dlist_terminate(TT.reg);
 
+  // Plain literals (no anchors or wildcards) go in the automaton, anything
+  // left uses the first character buckets.
+  for (last = &TT.e, len = 0, list = 0; *last;) {
+    ss = s = (*last)->arg;
+    if (!FLAG(F)) {
+      if (*s=='^') ss = 0;
+      else for (; *s; s++) {
+        if (*s=='.' || (*s=='$' && !s[1])) {
+          ss = 0;
+          break;
+        }
+        if (*s=='\\') s++;
+      }
+    }
+    if (!ss || !*ss) last = &((*last)->next);
+    else {
+      if (FLAG(F)) ss += strlen(ss);
+      else {
+        for (s = ss; *s; s++) *ss++ = *s=='\\' ? *++s : *s;
+        *ss = 0;
+      }
+      al = *last;
+      *last = al->next;
+      al->next = list;
+      list = al;
+      len += ss-al->arg;
+    }
+  }
+  if (list) {
+    char **pat;
+
+    for (ii = 0, al = list; al; al = al->next) ii++;
+    pat = xmalloc(sizeof(char *)*(ii+1));
+    for (ii = 0, al = list; al; al = al->next) pat[ii++] = al->arg;
+    pat[ii] = 0;
+    TT.ac = ac_build(pat, len);
+    free(pat);
+  }
+
   // Sort fast path patterns into buckets by first character
   for (al = TT.e; al; al = new) {
     new = al->next;
@@ -460,13 +714,17 @@ static int do_grep_r(struct dirtree *new)
 {
   struct arg_list *al;
   char *name;
+  int fd;
 
   if (!new->parent) TT.tried++;
   if (!dirtree_notdotdot(new)) return 0;
   if (S_ISDIR(new->st.st_mode)) {
     for (al = TT.exclude_dir; al; al = al->next)
       if (!fnmatch(al->arg, new->name, 0)) return 0;
-    return DIRTREE_RECURSE|DIRTREE_SYMFOLLOW*FLAG(R);
+    // "grep -r onefile" doesn't show filenames, but "grep -r onedir" should.
+    if (!new->parent && !FLAG(h)) toys.optflags |= FLAG_H;
+
+    return DIRTREE_RECURSE|DIRTREE_SYMFOLLOW*FLAG(R)|DIRTREE_NOSTAT;
   }
   if (TT.S || TT.M) {
     for (al = TT.S; al; al = al->next)
@@ -480,11 +738,12 @@ static int do_grep_r(struct dirtree *new)
     }
   }
 
-  // "grep -r onefile" doesn't show filenames, but "grep -r onedir" should.
-  if (new->parent && !FLAG(h)) toys.optflags |= FLAG_H;
-
   name = dirtree_path(new, 0);
-  do_grep(openat(dirtree_parentfd(new), new->name, 0), name);
+  if (0>(fd = openat(dirtree_parentfd(new), new->name, 0))) grep_perror(name);
+  else {
+    do_grep(fd, name);
+    close(fd);
+  }
   free(name);
 
   return 0;
@@ -550,7 +809,7 @@ void grep_main(void)
     // Iterate through -r arguments. Use "." as default if none provided.
     for (ss = *ss ? ss : (char *[]){".", 0}; *ss; ss++) {
       if (!strcmp(*ss, "-")) do_grep(0, *ss);
-      else dirtree_read(*ss, do_grep_r);
+      else dirtree_parallel(*ss, 0, do_grep_r);
     }
   } else loopfiles_rw(ss, O_RDONLY|WARN_ONLY, 0, do_grep);
   if (TT.tried >= toys.optc || (FLAG(q)&&TT.found)) toys.exitval = !TT.found;
@@ -27,15 +27,16 @@ GLOBALS(
   char *d;
 
   int files;
+  struct linebuf **lbs, *in;
 )
 
 // \0 is weird, and -d "" is also weird.
 
 static void paste_files(void)
 {
-  FILE **fps = (void *)toybuf;
   char *dpos, *dstr, *buf, c;
-  int i, any, dcount, dlen, len, seq = toys.optflags&FLAG_s;
+  int i, any, dcount, dlen, seq = toys.optflags&FLAG_s;
+  long len;
 
   // Loop through lines until no input left
   for (;;) {
@@ -44,18 +45,21 @@ static void paste_files(void)
     dpos = TT.d;
 
     for (i = any = dcount = dlen = 0; seq || i<TT.files; i++) {
-      size_t blen;
       unsigned wc;
-      FILE *ff = seq ? *fps : fps[i];
+      struct linebuf *lb = seq ? *TT.lbs : TT.lbs[i];
 
       // Read and output line, preserving embedded NUL bytes.
 
       buf = 0;
       len = 0;
-      if (!ff || 0>=(len = getline(&buf, &blen, ff))) {
-        if (ff && ff!=stdin) fclose(ff);
+      if (!lb || !(buf = linebuf_next(lb, &len))) {
+        if (lb && lb!=TT.in) {
+          close(lb->fd);
+          linebuf_free(lb);
+          free(lb);
+        }
         if (seq) return;
-        fps[i] = 0;
+        TT.lbs[i] = 0;
         if (!any) continue;
       }
       dcount = any ? 1 : i;
@@ -96,10 +100,7 @@ static void paste_files(void)
         if (dlen) fwrite(dstr, dlen, 1, stdout);
       }
 
-      if (0<len) {
-        fwrite(buf, len-(buf[len-1]=='\n'), 1, stdout);
-        free(buf);
-      }
+      if (0<len) fwrite(buf, len-(buf[len-1]=='\n'), 1, stdout);
     }
 
     // Only need a newline if we output something
@@ -110,10 +111,16 @@ static void paste_files(void)
 
 static void do_paste(int fd, char *name)
 {
-  FILE **fps = (void *)toybuf;
+  struct linebuf *lb = fd ? 0 : TT.in;
 
-  if (!(fps[TT.files++] = (fd ? fdopen(fd, "r") : stdin))) perror_exit(0);
-  if (TT.files >= sizeof(toybuf)/sizeof(FILE *)) perror_exit("tilt");
+  // Every "-" reads the same stdin buffer, so "paste - -" takes turns.
+  if (!lb) {
+    linebuf_init(lb = xmalloc(sizeof(*lb)), fd, '\n');
+    if (!fd) TT.in = lb;
+  }
+  if (!(TT.files&15))
+    TT.lbs = xrealloc(TT.lbs, sizeof(struct linebuf *)*(TT.files+16));
+  TT.lbs[TT.files++] = lb;
   if (toys.optflags&FLAG_s) {
     paste_files();
     xputc('\n');
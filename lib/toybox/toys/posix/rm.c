@@ -58,7 +58,8 @@ static int do_rm(struct dirtree *try)
       if (FLAG(f)) wfchmodat(fd, try->name, 0700);
       else goto skip;
     }
-    if (!try->again) return DIRTREE_COMEAGAIN;
+    // Children only need their file type
+    if (!try->again) return DIRTREE_COMEAGAIN|DIRTREE_NOSTAT;
     if (try->symlink) goto skip;
     if (FLAG(i)) {
       char *s = dirtree_path(try, 0);
@@ -112,6 +113,8 @@ void rm_main(void)
     // There's a race here where a file removed between the above check and
     // dirtree's stat would report the nonexistence as an error, but that's
     // not a normal "it didn't exist" so I'm ok with it.
-    dirtree_read(*s, do_rm);
+    // Without prompts, remove several directories' contents at once.
+    if (FLAG(i) || (!FLAG(f) && isatty(0))) dirtree_read(*s, do_rm);
+    else dirtree_parallel(*s, 0, do_rm);
   }
 }
@@ -236,9 +236,8 @@ static void sed_line(char **pline, long plen)
   if (FLAG(tarxform)) {
     if (!pline) return;
 
-    line = *pline;
+    line = xmemdup(*pline, plen+1);
     len = plen;
-    *pline = 0;
     pline = 0;
   } else {
     line = TT.nextline;
@@ -253,9 +252,8 @@ static void sed_line(char **pline, long plen)
     TT.nextline = 0;
     TT.nextlen = 0;
     if (pline) {
-      TT.nextline = *pline;
+      TT.nextline = xmemdup(*pline, plen+1);
       TT.nextlen = plen;
-      *pline = 0;
     }
   }
 
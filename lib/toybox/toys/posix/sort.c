@@ -7,13 +7,13 @@
  * Deviations from POSIX: Lots.
  * We invented -x
 
-USE_SORT(NEWTOY(sort, USE_SORT_FLOAT("g")"S:T:m" "o:k*t:" "xVbMCcszdfirun", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_ARGFAIL(2)))
+USE_SORT(NEWTOY(sort, "(parallel)#<1=1"USE_SORT_FLOAT("g")"S:T:m" "o:k*t:" "xVbMCcszdfirun", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_ARGFAIL(2)))
 
 config SORT
   bool "sort"
   default y
   help
-    usage: sort [-runbCcdfiMsxVz] [FILE...] [-k#[,#[x]] [-t X]] [-o FILE]
+    usage: sort [-runbCcdfiMsxVz] [FILE...] [-k#[,#[x]] [-t X]] [-o FILE] [-S SIZE] [-T DIR]
 
     Sort all lines of text from input files (or stdin) to stdout.
 
@@ -36,6 +36,10 @@ config SORT
     -V	Version numbers (name-1.234-rc6.5b.tgz)
     -z	Zero (null) terminated lines
 
+    -S	Buffer SIZE before spilling to temp files (K/M/G suffix, or % of memory)
+    -T	Temp file DIR (default $TMPDIR or /tmp)
+    --parallel=N	Sort with N threads
+
     Sorting by key looks at a subset of the words on each line. -k2 uses the
     second word to the end of the line, -k2,2 looks at only the second word,
     -k2,4 looks from the start of the second to the end of the fourth word.
@@ -56,15 +60,19 @@ config SORT_FLOAT
 
 #define FOR_sort
 #include "toys.h"
+#include <pthread.h>
 
 GLOBALS(
   char *t;
   struct arg_list *k;
-  char *o, *T, S;
+  char *o, *T, *S;
+  long parallel;
 
   void *key_list;
-  unsigned linecount;
+  unsigned linecount, nruns;
   char **lines, *name;
+  size_t size, limit;
+  struct sort_run **runs;
 )
 
 // The sort types are n, g, and M.
@@ -280,15 +288,241 @@ static int compare_keys(const void *xarg, const void *yarg)
   return retval * ((flags&FLAG_r) ? -1 : 1);
 }
 
+// A sorted run of lines, either still in memory or spilled to a temp file.
+struct sort_run {
+  char **lines, *line;
+  unsigned count, pos, order, level;
+  FILE *fp;
+  pthread_t thread;
+  int busy;
+};
+
+// Sort lines in memory, discarding duplicates for -u.
+static unsigned sort_array(char **lines, unsigned count)
+{
+  unsigned idx, jdx;
+
+  qsort(lines, count, sizeof(char *), compare_keys);
+  if (!FLAG(u) || !count) return count;
+  for (jdx=0, idx=1; idx<count; idx++) {
+    if (!compare_keys(lines+jdx, lines+idx)) free(lines[idx]);
+    else lines[++jdx] = lines[idx];
+  }
+
+  return jdx+1;
+}
+
+static void sort_write(FILE *fp, char *s)
+{
+  fputs(s, fp);
+  fputc('\n'*!FLAG(z), fp);
+  free(s);
+}
+
+// Write a run's lines to its temp file, in a thread for --parallel.
+static void *sort_spill(void *arg)
+{
+  struct sort_run *run = arg;
+  unsigned idx;
+
+  run->count = sort_array(run->lines, run->count);
+  for (idx = 0; idx<run->count; idx++) sort_write(run->fp, run->lines[idx]);
+  free(run->lines);
+  run->lines = 0;
+  run->count = 0;
+  if (fflush(run->fp) || fseek(run->fp, 0, SEEK_SET)) perror_exit("sort -T");
+
+  return 0;
+}
+
+static void *sort_chunk(void *arg)
+{
+  struct sort_run *run = arg;
+
+  run->count = sort_array(run->lines, run->count);
+
+  return 0;
+}
+
+// Run fn on the run, in a new thread if --parallel allows one.
+static void sort_start(struct sort_run *run, void *(*fn)(void *))
+{
+  if (TT.parallel<2 || pthread_create(&run->thread, 0, fn, run)) fn(run);
+  else run->busy++;
+}
+
+static void sort_wait(struct sort_run *run)
+{
+  if (run->busy) pthread_join(run->thread, 0);
+  run->busy = 0;
+}
+
+static struct sort_run *add_run(char **lines, unsigned count)
+{
+  struct sort_run *run = xzalloc(sizeof(struct sort_run));
+
+  if (!(TT.nruns&15))
+    TT.runs = xrealloc(TT.runs, sizeof(struct sort_run *)*(TT.nruns+16));
+  TT.runs[TT.nruns++] = run;
+  run->lines = lines;
+  run->count = count;
+  run->order = TT.nruns;
+
+  return run;
+}
+
+// Unlinked temp file in -T or $TMPDIR.
+static FILE *sort_tempfile(void)
+{
+  char *dir = TT.T ? : getenv("TMPDIR") ? : "/tmp", *name, *tmp;
+  int fd;
+
+  tmp = xmprintf("%s/sort.", dir);
+  fd = xtempfile(tmp, &name);
+  unlink(name);
+  free(name);
+  free(tmp);
+
+  return xfdopen(fd, "w+");
+}
+
+// Advance run to its next line, returning 0 at the end.
+static int run_next(struct sort_run *run)
+{
+  size_t size = 0;
+  ssize_t len;
+
+  if (!run->fp) {
+    if (run->pos == run->count) return 0;
+    run->line = run->lines[run->pos++];
+
+    return 1;
+  }
+  run->line = 0;
+  if (0>(len = getdelim(&run->line, &size, '\n'*!FLAG(z), run->fp))) {
+    free(run->line);
+    fclose(run->fp);
+    run->fp = 0;
+
+    return 0;
+  }
+  if (len && run->line[len-1]==('\n'*!FLAG(z))) run->line[len-1] = 0;
+
+  return 1;
+}
+
+// Heap order: lowest line first, earlier run on ties.
+static int run_less(struct sort_run **heap, int a, int b)
+{
+  int i = compare_keys(&heap[a]->line, &heap[b]->line);
+
+  return i ? i<0 : heap[a]->order<heap[b]->order;
+}
+
+// Merge runs into fp with a binary heap, freeing them.
+static void sort_merge(struct sort_run **runs, unsigned count, FILE *fp)
+{
+  struct sort_run **heap = xmalloc(sizeof(struct sort_run *)*count), *run;
+  char *last = 0;
+  int n = 0, i, j;
+
+  for (i = 0; i<count; i++) {
+    sort_wait(runs[i]);
+    if (!run_next(runs[i])) {
+      free(runs[i]->lines);
+      free(runs[i]);
+      continue;
+    }
+
+    // Sift the new run up.
+    for (heap[j = n++] = runs[i]; j && run_less(heap, j, (j-1)/2); j = (j-1)/2)
+      run = heap[j], heap[j] = heap[(j-1)/2], heap[(j-1)/2] = run;
+  }
+
+  while (n) {
+    run = *heap;
+
+    // -u keeps the first of each set of equal lines.
+    if (last && FLAG(u) && !compare_keys(&last, &run->line)) free(run->line);
+    else {
+      if (last) sort_write(fp, last);
+      last = run->line;
+    }
+
+    if (!run_next(run)) {
+      free(run->lines);
+      free(run);
+      *heap = heap[--n];
+    }
+
+    // Sift the new top down.
+    for (i = 0; (j = 2*i+1)<n; i = j) {
+      if (j+1<n && run_less(heap, j+1, j)) j++;
+      if (!run_less(heap, j, i)) break;
+      run = heap[i], heap[i] = heap[j], heap[j] = run;
+    }
+  }
+  if (last) sort_write(fp, last);
+  free(heap);
+}
+
+// Sort the buffered lines into a new run, in a temp file unless this is the
+// end of the input. Every 16 temp files of one level get merged into a file
+// of the next level, so each line is rewritten once per level.
+static void sort_flush(int spill)
+{
+  struct sort_run *run;
+  unsigned i;
+
+  // Levels never increase along TT.runs, so equal ends mean 16 equal levels.
+  while (spill && TT.nruns >= 16
+    && TT.runs[TT.nruns-16]->level == TT.runs[TT.nruns-1]->level)
+  {
+    for (i = 0; i<TT.nruns; i++) sort_wait(TT.runs[i]);
+    i = TT.nruns -= 16;
+    run = xzalloc(sizeof(struct sort_run));
+    run->fp = sort_tempfile();
+    run->order = i+1;
+    run->level = TT.runs[i]->level+1;
+    sort_merge(TT.runs+i, 16, run->fp);
+    if (fflush(run->fp) || fseek(run->fp, 0, SEEK_SET)) perror_exit("sort -T");
+    TT.runs[TT.nruns++] = run;
+  }
+
+  // Keep at most --parallel buffers in memory, counting the one being read.
+  if (TT.parallel>1 && TT.nruns+1 >= TT.parallel)
+    sort_wait(TT.runs[TT.nruns+1-TT.parallel]);
+
+  run = add_run(TT.lines, TT.linecount);
+  if (spill) {
+    run->fp = sort_tempfile();
+    sort_start(run, sort_spill);
+  } else if (TT.parallel>1 && TT.linecount>=TT.parallel*1024) {
+    // Split the last buffer into chunks for the threads to sort.
+    for (i = 0; i<TT.parallel; i++) {
+      unsigned start = (long long)TT.linecount*i/TT.parallel,
+        end = (long long)TT.linecount*(i+1)/TT.parallel;
+
+      if (i) run = add_run(xmemdup(TT.lines+start, sizeof(char *)*(end-start)),
+        end-start);
+      else run->count = end;
+      sort_start(run, sort_chunk);
+    }
+  } else sort_chunk(run);
+
+  TT.lines = 0;
+  TT.linecount = 0;
+  TT.size = 0;
+}
+
 // Read each line from file, appending to a big array.
 static void sort_lines(char **pline, long len)
 {
   char *line;
 
   if (!pline) return;
-  line = *pline;
-  if (!FLAG(z) && len && line[len-1]=='\n') line[--len] = 0;
-  *pline = 0;
+  if (!FLAG(z) && len && (*pline)[len-1]=='\n') (*pline)[--len] = 0;
+  line = xmemdup(*pline, len+1);
 
   // handle -c here so we don't allocate more memory than necessary.
   if (FLAG(C)||FLAG(c)) {
@@ -300,9 +534,11 @@ static void sort_lines(char **pline, long len)
     free(TT.lines);
     TT.lines = (void *)line;
   } else {
+    if (TT.size >= TT.limit) sort_flush(1);
     if (!(TT.linecount&63))
       TT.lines = xrealloc(TT.lines, sizeof(char *)*(TT.linecount+64));
     TT.lines[TT.linecount] = line;
+    TT.size += len+1+sizeof(char *);
   }
   TT.linecount++;
 }
@@ -314,9 +550,27 @@ static void sort_read(int fd, char *name)
   do_lines(fd, '\n'*!FLAG(z), sort_lines);
 }
 
+// Parse -S: bytes with a k/m/g suffix, kilobytes without, or % of memory.
+static size_t sort_size(char *s)
+{
+  long long size, mem = (long long)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGESIZE);
+  char *end;
+
+  if (!s) return mem/8;
+  if (*(end = s+strlen(s)-1) == '%') {
+    size = strtoll(s, &end, 10);
+    if (*end != '%' || end[1] || size<0 || size>100) error_exit("bad -S '%s'", s);
+    size = mem*size/100;
+  } else size = isdigit(*end) ? atolx(s)*1024 : atolx(s);
+
+  // Lines need somewhere to go, even with tiny buffers.
+  return size<4096 ? 4096 : size;
+}
+
 void sort_main(void)
 {
-  int idx, jdx, fd = 1;
+  int idx;
+  FILE *fp = stdout;
 
   if (FLAG(u)) toys.optflags |= FLAG_s;
 
@@ -345,9 +599,9 @@ void sort_main(void)
             break;
           }
 
-          // Which flag is this?
+          // Which flag is this? (Search from the end to skip "(parallel)".)
           optlist = toys.which->options;
-          temp2 = strchr(optlist, *temp);
+          temp2 = strrchr(optlist, *temp);
           flag = 1<<(optlist-temp2+strlen(optlist)-1);
 
           // Was it a flag that can apply to a key?
@@ -368,42 +622,32 @@ void sort_main(void)
   // If no keys, perform alphabetic sort over the whole line.
   if (!TT.key_list) add_key()->range[0] = 1;
 
+  // Each thread gets its share of the buffer.
+  TT.limit = sort_size(TT.S)/TT.parallel;
+
   // Open input files and read data, populating TT.lines[TT.linecount]
+  // and spilling sorted runs to temp files when the buffer fills up.
   loopfiles(toys.optargs, sort_read);
 
   // The compare (-c) logic was handled in sort_read(),
   // so if we got here, we're done.
-  if (FLAG(C)||FLAG(c)) goto exit_now;
+  if (FLAG(C)||FLAG(c)) {
+    if (CFG_TOYBOX_FREE) free(TT.lines);
+    return;
+  }
 
   // Perform the actual sort
-  qsort(TT.lines, TT.linecount, sizeof(char *), compare_keys);
-
-  // handle unique (-u)
-  if (FLAG(u)) {
-    for (jdx=0, idx=1; idx<TT.linecount; idx++) {
-      if (!compare_keys(&TT.lines[jdx], &TT.lines[idx])) free(TT.lines[idx]);
-      else TT.lines[++jdx] = TT.lines[idx];
-    }
-    if (TT.linecount) TT.linecount = jdx+1;
-  }
+  sort_flush(0);
 
   // Open output file if necessary. We can't do this until we've finished
   // reading in case the output file is one of the input files.
-  if (TT.o) fd = xcreate(TT.o, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+  if (TT.o) fp = xfdopen(xcreate(TT.o, O_CREAT|O_TRUNC|O_WRONLY, 0666), "w");
 
   // Output result
-  for (idx = 0; idx<TT.linecount; idx++) {
-    char *s = TT.lines[idx];
-    unsigned i = strlen(s);
-
-    if (!FLAG(z)) s[i] = '\n';
-    xwrite(fd, s, i+1);
-    if (CFG_TOYBOX_FREE) free(s);
-  }
-
-exit_now:
+  sort_merge(TT.runs, TT.nruns, fp);
+  if (fflush(fp) || ferror(fp)) perror_exit("write");
   if (CFG_TOYBOX_FREE) {
-    if (fd != 1) close(fd);
-    free(TT.lines);
+    if (fp != stdout) fclose(fp);
+    free(TT.runs);
   }
 }
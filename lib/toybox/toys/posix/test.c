@@ -70,7 +70,7 @@ static int do_test(char **args, int *count)
       // Ala [[ abc =~ "1"* ]] matches but [[ abc =~ 1"*" ]] does not
       xregcomp(&reg, args[2], REG_NOSUB); // REG_EXTENDED? REG_ICASE?
       i = regexec(&reg, args[0], 0, 0, 0);
-      regfree(&reg);
+      xregfree(&reg);
 
       return !i;
     }
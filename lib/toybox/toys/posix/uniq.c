@@ -58,57 +58,50 @@ static void print_line(FILE *f, char *line)
 
 void uniq_main(void)
 {
-  FILE *infile = stdin, *outfile = stdout;
-  char *thisline = 0, *prevline = 0, *tmpline, eol = '\n';
-  size_t thissize, prevsize = 0, tmpsize;
+  FILE *outfile = stdout;
+  struct linebuf lb;
+  char *thisline, *prevline = 0;
+  long len, prevsize = 0;
 
-  if (toys.optc >= 1) infile = xfopen(toys.optargs[0], "r");
+  linebuf_init(&lb, toys.optc ? xopenro(*toys.optargs) : 0, '\n'*!FLAG(z));
   if (toys.optc >= 2) outfile = xfopen(toys.optargs[1], "w");
 
-  if (FLAG(z)) eol = 0;
-
-  // If first line can't be read
-  if (getdelim(&prevline, &prevsize, eol, infile) < 0) return;
-
-  while (getdelim(&thisline, &thissize, eol, infile) > 0) {
-    int diff;
+  // Lines come from a reused buffer, so keep a copy of the previous one
+  // (only needed when it changes).
+  while ((thisline = linebuf_next(&lb, &len))) {
+    int diff = 1;
     char *t1, *t2;
 
-    // If requested get the chosen fields + character offsets.
-    if (TT.f || TT.s) {
-      t1 = skip(thisline);
-      t2 = skip(prevline);
-    } else {
-      t1 = thisline;
-      t2 = prevline;
+    if (prevline) {
+      // If requested get the chosen fields + character offsets.
+      if (TT.f || TT.s) {
+        t1 = skip(thisline);
+        t2 = skip(prevline);
+      } else {
+        t1 = thisline;
+        t2 = prevline;
+      }
+
+      if (!TT.w)
+        diff = !FLAG(i) ? strcmp(t1, t2) : strcasecmp(t1, t2);
+      else diff = !FLAG(i) ? strncmp(t1, t2, TT.w) : strncasecmp(t1, t2, TT.w);
     }
 
-    if (!TT.w)
-      diff = !FLAG(i) ? strcmp(t1, t2) : strcasecmp(t1, t2);
-    else diff = !FLAG(i) ? strncmp(t1, t2, TT.w) : strncasecmp(t1, t2, TT.w);
-
     if (!diff) TT.repeats++;
     else {
-      print_line(outfile, prevline);
-
+      if (prevline) print_line(outfile, prevline);
       TT.repeats = 0;
-
-      tmpline = prevline;
-      prevline = thisline;
-      thisline = tmpline;
-
-      tmpsize = prevsize;
-      prevsize = thissize;
-      thissize = tmpsize;
+      if (len >= prevsize) prevline = xrealloc(prevline, prevsize = len+1);
+      memcpy(prevline, thisline, len+1);
     }
   }
 
-  print_line(outfile, prevline);
+  if (prevline) print_line(outfile, prevline);
 
   if (CFG_TOYBOX_FREE) {
     if (outfile != stdout) fclose(outfile);
-    if (infile != stdin) fclose(infile);
+    if (lb.fd) close(lb.fd);
+    linebuf_free(&lb);
     free(prevline);
-    free(thisline);
   }
 }
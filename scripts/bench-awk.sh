@@ -0,0 +1,47 @@
+#!/bin/sh
+
+# Measure a report over about N records and a loop of N*10 iterations,
+# three runs each: wak translates programs that run long enough to C on the
+# first run, and runs them compiled (through cc -run and its cache) after.
+#
+# usage: scripts/bench-awk.sh [N] [awk...]
+
+N=${1:-300000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- awk
+
+TMP=${TMPDIR:-/tmp}/bench-awk.$$
+trap 'rm -f "$TMP"' EXIT
+i=0
+while [ $i -lt 100 ]; do
+  echo "k$i $i x y z"
+  i=$((i+1))
+done > "$TMP"
+j=1
+while [ $j -lt $((N / 100)) ]; do
+  cat "$TMP" "$TMP" > "$TMP.2" && mv "$TMP.2" "$TMP"
+  j=$((j*2))
+done
+
+REPORT='{ s[$1] += $2; n[$1]++; if ($2 > m) m = $2; t += length($3) }
+END { for (k in s) printf "%s %d %.2f\n", k, n[k], s[k] / n[k] | "sort"
+  close("sort"); print m, t }'
+LOOP='function f(n) { return n < 2 ? n : f(n-1) + f(n-2) }
+BEGIN { for (i = 0; i < N * 10; i++) { s += i % 7; if (i % 3 == 1) x++ }
+  print s, x, f(20) }'
+
+run() {
+  name=$1
+  shift
+  start=$(date +%s%N)
+  out=$("$AWK" "$@" | cksum)
+  end=$(date +%s%N)
+  echo "$AWK: $(( (end - start) / 1000000 )) ms for $name ($out)"
+}
+
+for AWK in "$@"; do
+  for k in 1 2 3; do
+    run report "$REPORT" "$TMP"
+    run loop -v N="$N" "$LOOP"
+  done
+done
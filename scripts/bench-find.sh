@@ -0,0 +1,48 @@
+#!/bin/sh
+
+# Measure walking a tree of about N files: find -name, du, grep -r and rm -r.
+#
+# usage: scripts/bench-find.sh [N] [shell...]
+
+N=${1:-100000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+TMP=${TMPDIR:-/tmp}/bench-find.$$
+trap 'rm -rf "$TMP" "$TMP.rm"' EXIT
+mkdir -p "$TMP"
+(
+  cd "$TMP" || exit
+  i=0
+  while [ $i -lt $((N / 1000)) ]; do
+    j=0
+    while [ $j -lt 20 ]; do
+      mkdir -p d$i/e$j && cd d$i/e$j || exit
+      printf 'x\n' | tee f0.h f1.h f2.h f3.h f4.h f5.h f6.h f7.h f8.h f9.h \
+        g0.h g1.h g2.h g3.h g4.h g5.h g6.h g7.h g8.h g9.h \
+        h0.h h1.h h2.h h3.h h4.h h5.h h6.h h7.h h8.h h9.h \
+        i0.c i1.c i2.c i3.c i4.c i5.c i6.c i7.c i8.c i9.c > /dev/null
+      printf 'needle\n' | tee j0.c j1.c j2.c j3.c j4.c j5.c j6.c j7.c j8.c \
+        j9.c > /dev/null
+      cd ../..
+      j=$((j+1))
+    done
+    i=$((i+1))
+  done
+)
+
+run() {
+  start=$(date +%s%N)
+  out=$("$SH" -c 'command "$@" | command wc -l' sh "$@")
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for $* ($out)"
+}
+
+for SH in "$@"; do
+  run find "$TMP" -name '*.c'
+  run find "$TMP" -type f
+  run du -a "$TMP"
+  run grep -rl needle "$TMP"
+  cp -R "$TMP" "$TMP.rm"
+  run rm -rf "$TMP.rm"
+done
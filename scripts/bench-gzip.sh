@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# Measure gzip compression ratio and throughput for each level over a
+# corpus (by default the decompressed contents of tarballs/).
+#
+# usage: scripts/bench-gzip.sh [file...]
+
+SH=${SH:-build/bootsh}
+TMP=${TMPDIR:-/tmp}/bench-gzip.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+if [ $# -eq 0 ]; then
+  for f in tarballs/*.tar.gz; do
+    "$SH" -c "zcat '$f'" > "$TMP/$(basename "$f" .gz)"
+  done
+  set -- "$TMP"/*.tar
+fi
+
+cat "$@" > "$TMP/corpus"
+size=$(wc -c < "$TMP/corpus")
+echo "corpus: $size bytes"
+
+for level in 1 2 3 4 5 6 7 8 9; do
+  start=$(date +%s%N)
+  "$SH" -c "gzip -c$level" < "$TMP/corpus" > "$TMP/corpus.gz"
+  end=$(date +%s%N)
+  out=$(wc -c < "$TMP/corpus.gz")
+  ms=$(( (end - start) / 1000000 ))
+  [ $ms -eq 0 ] && ms=1
+  echo "-$level: $out bytes ($(( out * 1000 / size ))/1000), $ms ms, $(( size / 1000 / ms )) MB/s"
+  "$SH" -c "zcat" < "$TMP/corpus.gz" | cmp -s - "$TMP/corpus" || echo "-$level: round trip FAILED"
+done
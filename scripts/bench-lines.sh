@@ -0,0 +1,35 @@
+#!/bin/sh
+
+# Measure lines per second through the line-at-a-time text commands, over
+# an N line file.
+#
+# usage: scripts/bench-lines.sh [N] [shell...]
+
+N=${1:-500000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+TMP=${TMPDIR:-/tmp}/bench-lines.$$
+trap 'rm -f "$TMP" "$TMP.2"' EXIT
+awk -v n="$N" 'BEGIN {
+  for (i = 1; i <= n; i++) print int(i / 3) " field" i % 7 " " i * 7
+}' > "$TMP"
+sed -n '1~2p' "$TMP" > "$TMP.2"
+
+run() {
+  start=$(date +%s%N)
+  out=$("$SH" -c 'command "$@" | command cksum' sh "$@")
+  end=$(date +%s%N)
+  ms=$(( (end - start) / 1000000 ))
+  printf '%s: %d ms, %d lines/s for %s (%s)\n' "$SH" $ms \
+    $(( N * 1000 / (ms + 1) )) "$*" "${out%% *}"
+}
+
+for SH in "$@"; do
+  run sort "$TMP"
+  run uniq "$TMP"
+  run cut -d ' ' -f 2 "$TMP"
+  run sed 's/field/f/' "$TMP"
+  run paste "$TMP" "$TMP"
+  run comm "$TMP" "$TMP.2"
+done
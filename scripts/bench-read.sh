@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# Measure a shell 'while read' loop over N lines, from a regular file and
+# from a pipe, and check that read leaves the rest of the input alone.
+#
+# usage: scripts/bench-read.sh [N] [shell...]
+
+N=${1:-1000000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+TMP=${TMPDIR:-/tmp}/bench-read.$$
+trap 'rm -f "$TMP"' EXIT
+
+seq -f 'line %g of the input' "$N" > "$TMP"
+
+for SH in "$@"; do
+  for from in file pipe; do
+    loop='n=0; while read -r a b c; do n=$((n+1)); done; echo $n'
+    [ $from = file ] && cmd="{ $loop; } < '$TMP'" || cmd="cat '$TMP' | { $loop; }"
+    start=$(date +%s%N)
+    n=$("$SH" -c "$cmd")
+    end=$(date +%s%N)
+    [ "$n" = "$N" ] || echo "$SH: read $n of $N lines from a $from"
+    echo "$SH: $(( (end - start) / 1000000 )) ms to read $N lines from a $from"
+  done
+
+  for from in file pipe; do
+    cmd="{ read a; read b; head -n 1; }"
+    [ $from = file ] && cmd="$cmd < '$TMP'" || cmd="cat '$TMP' | $cmd"
+    [ "$("$SH" -c "$cmd")" = "line 3 of the input" ] ||
+      echo "$SH: read took too much from a $from"
+  done
+done
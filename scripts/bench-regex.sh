@@ -0,0 +1,34 @@
+#!/bin/sh
+
+# Measure grep -E and sed substitutions over an N line file, the regular
+# expressions configure scripts and build rules spend their time in.
+#
+# usage: scripts/bench-regex.sh [N] [shell...]
+
+N=${1:-300000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+TMP=${TMPDIR:-/tmp}/bench-regex.$$
+trap 'rm -f "$TMP"' EXIT
+awk -v n="$N" 'BEGIN {
+  split("alpha beta gamma delta epsilon zeta", w)
+  for (i = 1; i <= n; i++)
+    print "line " i " of " n ": " w[i % 6 + 1] " " w[i % 5 + 1] " " i * 7
+}' > "$TMP"
+
+run() {
+  start=$(date +%s%N)
+  out=$("$SH" -c 'command "$@"' sh "$@" "$TMP" | tail -n 1)
+  end=$(date +%s%N)
+  printf '%s: %d ms for %s (%s)\n' "$SH" $(( (end - start) / 1000000 )) "$*" "$out"
+}
+
+for SH in "$@"; do
+  run grep -cE 'alpha.*gam+a'
+  run grep -cE '[0-9]+5 of'
+  run grep -cE 'zeta|beta 7'
+  run grep -c 'line [0-9]*7 of'
+  run sed -E 's/(alpha|beta) ([a-z]+)/\2 \1/'
+  run sed 's/[0-9][0-9]*$/N/'
+done
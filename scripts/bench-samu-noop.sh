@@ -0,0 +1,52 @@
+#!/bin/sh
+
+# Measure no-op ninja time on a synthetic manifest of N edges with deps
+# recorded in .ninja_deps, for a full build and for a single target.
+#
+# usage: scripts/bench-samu-noop.sh [N] [shell...]
+
+N=${1:-50000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+HEADERS=1000
+RUNS=5
+TMP=${TMPDIR:-/tmp}/bench-samu.$$
+trap 'rm -rf "$TMP"' EXIT
+
+# each edge copies a prepared depfile naming 20 of the headers into its
+# output, which doubles as the depfile
+"$1" -c "
+set -e
+mkdir -p '$TMP/h' '$TMP/src' '$TMP/out'
+cd '$TMP'
+i=0
+while [ \$i -lt $HEADERS ]; do : > h/\$i.h; i=\$((i+1)); done
+{
+  printf 'rule cp\n  command = cp \$in \$out\n  deps = gcc\n  depfile = \$out\n'
+  i=0
+  while [ \$i -lt $N ]; do
+    printf 'build out/%d.o: cp src/%d.d\n' \$i \$i
+    {
+      printf 'out/%d.o:' \$i
+      j=0
+      while [ \$j -lt 20 ]; do printf ' h/%d.h' \$(( (i * 7 + j * 53) % $HEADERS )); j=\$((j+1)); done
+      echo
+    } > src/\$i.d
+    i=\$((i+1))
+  done
+} > build.ninja
+ninja -d keepdepfile > /dev/null
+"
+
+for SH in "$@"; do
+  for target in "" out/0.o; do
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $RUNS ]; do
+      "$SH" -c "cd '$TMP' && ninja $target" > /dev/null 2>&1
+      i=$((i+1))
+    done
+    end=$(date +%s%N)
+    echo "$SH: $(( (end - start) / RUNS / 1000000 )) ms per no-op 'ninja $target' ($N edges)"
+  done
+done
@@ -0,0 +1,16 @@
+#!/bin/sh
+
+# Measure shell startup latency by running `sh -c true` N times.
+#
+# usage: scripts/bench-startup.sh [N] [shell...]
+
+N=${1:-1000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+for SH in "$@"; do
+  start=$(date +%s%N)
+  "$SH" -c "i=0; while [ \$i -lt $N ]; do '$SH' -c true; i=\$((i+1)); done"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / N / 1000 )) us per 'sh -c true' ($N runs)"
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Measure N command substitutions of a builtin and N here documents too
+# big for a pipe, the two things configure scripts do most.
+#
+# usage: scripts/bench-subst.sh [N] [shell...]
+
+N=${1:-10000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+for SH in "$@"; do
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $N ]; do
+  x=\$(printf '%s-%d' foo \$i)
+  i=\$((i+1))
+done
+[ \"\$x\" = foo-$((N - 1)) ] || echo \"$SH: wrong output \$x\" >&2
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for $N \$(printf ...)"
+
+  start=$(date +%s%N)
+  "$SH" -c "
+doc=\$(seq 20000)
+i=0
+while [ \$i -lt $N ]; do
+  read -r x <<END
+\$doc
+END
+  i=\$((i+1))
+done
+[ \"\$x\" = 1 ] || echo \"$SH: wrong output \$x\" >&2
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for $N large here documents"
+done
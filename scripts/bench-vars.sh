@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Measure setting and reading N shell variables, defining and calling N
+# functions, and running commands, external and built into the binary,
+# with N/10 exported variables, also changing one before each command.
+#
+# usage: scripts/bench-vars.sh [N] [shell...]
+
+N=${1:-20000}
+E=$((N / 10))
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- build/bootsh
+
+for SH in "$@"; do
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $N ]; do eval \"v\$i=\$i\"; i=\$((i+1)); done
+i=0; s=0
+while [ \$i -lt $N ]; do eval \"s=\\\$((s+v\$i))\"; i=\$((i+1)); done
+[ \$s = $(( N * (N - 1) / 2 )) ] || echo \"$SH: wrong sum \$s\" >&2
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for $N variables"
+
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $N ]; do eval \"f\$i() { :; }\"; i=\$((i+1)); done
+i=0
+while [ \$i -lt $N ]; do f\$i; i=\$((i+1)); done
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for $N functions"
+
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $E ]; do export e\$i=\$i; i=\$((i+1)); done
+i=0
+while [ \$i -lt 200 ]; do /bin/true; i=\$((i+1)); done
+[ \$(env | grep -c ^e) = $E ] || echo \"$SH: wrong environment\" >&2
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for 200 commands with $E exports"
+
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $E ]; do export e\$i=\$i; i=\$((i+1)); done
+i=0
+while [ \$i -lt 200 ]; do basename x > /dev/null; i=\$((i+1)); done
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for 200 in-binary commands with $E exports"
+
+  start=$(date +%s%N)
+  "$SH" -c "
+i=0
+while [ \$i -lt $E ]; do export e\$i=\$i; i=\$((i+1)); done
+i=0
+while [ \$i -lt 200 ]; do export e0=\$i; basename x > /dev/null; i=\$((i+1)); done
+"
+  end=$(date +%s%N)
+  echo "$SH: $(( (end - start) / 1000000 )) ms for 200 exports and in-binary commands with $E exports"
+done
@@ -23,6 +23,7 @@
 
 // for getopt():
 #include <unistd.h>
+#include <sys/stat.h>
 #include <regex.h>
 #if defined(__unix__) || defined(linux)
 #include <langinfo.h>
@@ -189,6 +190,10 @@ struct global_data {
 #define RS_MAX  64
   char rs_last[RS_MAX];
   regex_t rx_rs_default, rx_rs_last;
+
+  char *native_src;   // this source, for the C made by native_save()
+  unsigned long long native_key;
+  int native;         // running that C, WAK_NATIVE matched native_key
 };
 #endif  // FOR_TOYBOX
 enum toktypes {
@@ -2905,6 +2910,15 @@ static int splitter(void (*setter)(struct zmap *, int, char *, size_t), struct z
   }
   if (IS_RX(zvfs)) rx = zvfs->rx;
   else rx = rx_fs_prep(fs);
+  // The default FS is runs of blanks and newlines, no need for regexec()
+  if (rx == &TT.rx_default) {
+    while (*(s += strspn(s, " \t\n"))) {
+      size_t len = strcspn(s, " \t\n");
+      setter(m, ++nf, s, len);
+      s += len;
+    }
+    return nf;
+  }
   while (*s) {
     // Find the next occurrence of FS.
     // rx_find_FS() returns 0 if found. If nonzero, the field will
@@ -3568,13 +3582,27 @@ static int rx_findx(regex_t *rx, char *s, long len, regoff_t *start, regoff_t *e
   return 0;
 }
 
+// Compile RS again only when it changes, not for every record
+static regex_t *rx_rs_prep(void)
+{
+  struct zvalue *rs = &STACK[RS];
+  char pat[RS_MAX];
+
+  if (IS_RX(rs)) return rs->rx;
+  if (!strcmp(rs->vst->str, TT.rs_last)) return &TT.rx_rs_last;
+  if (strlen(rs->vst->str) >= RS_MAX) FATAL("RS too long");
+  if (*TT.rs_last) regfree(&TT.rx_rs_last);
+  strcpy(TT.rs_last, rs->vst->str);
+  escape_str(strcpy(pat, TT.rs_last), 1);
+  xregcomp(&TT.rx_rs_last, pat, REG_EXTENDED);
+  return &TT.rx_rs_last;
+}
+
 static ssize_t getrec_f(struct zfile *zfp)
 {
   int r = 0, rs = ENSURE_STR(&STACK[RS])->vst->str[0] & 0xff;
   if (!rs) return getrec_multiline(zfp);
-  regex_t rsrx, *rsrxp = &rsrx;
-  // TEMP!! FIXME Need to cache and avoid too-frequent rx compiles
-  rx_zvalue_compile(&rsrxp, &STACK[RS]);
+  regex_t *rsrxp = rx_rs_prep();
   regoff_t so = 0, eo = 0;
   long ret = -1;
   for ( ;; ) {
@@ -3620,7 +3648,6 @@ static ssize_t getrec_f(struct zfile *zfp)
       break;
     }
   }
-  regfree(rsrxp);
   return ret;
 }
 
@@ -3797,10 +3824,14 @@ static void add_stack(struct zvalue **stackp_needmore)
 // Main loop of interpreter. Run this once for all BEGIN rules (which
 // have had their instructions chained in compile), all END rules (also
 // chained in compile), and once for each record of the data file(s).
-static int interpx(int start, int *status)
+// With pparmbase, run only the instruction at start for native code (see
+// native_save()) and return minus the address of the next one, unless it
+// quits; *pparmbase is the function frame, changed by calls and returns.
+static int interpx(int start, int *status, int *pparmbase)
 {
   int *ip = &ZCODE[start];
-  int opcode, op2, k, r, nargs, nsubscrs, range_num, parmbase = 0;
+  int opcode, op2, k, r, nargs, nsubscrs, range_num;
+  int parmbase = pparmbase ? *pparmbase : 0;
   int field_num;
   double nleft, nright, d;
   double (*mathfunc[])(double) = {cos, sin, exp, log, sqrt, trunc};
@@ -4567,10 +4598,18 @@ static int interpx(int start, int *status)
         // This should never happen:
         error_exit("!!! Unimplemented opcode %d", opcode);
     }
+    if (pparmbase) {
+      *pparmbase = parmbase;
+      return &ZCODE[0] - ip;
+    }
   }
   return opquit;
 }
 
+#ifdef WAK_NATIVE
+static int native(int start, int *status);
+#endif
+
 // interp() wraps the main interpreter loop interpx(). The main purpose
 // is to allow the TT.stack to be readjusted after an 'exit' from a function.
 // Also catches errors, as the normal operation should leave the TT.stack
@@ -4578,7 +4617,11 @@ static int interpx(int start, int *status)
 static int interp(int start, int *status)
 {
   int stkptrbefore = stkn(0);
-  int r = interpx(start, status);
+#ifdef WAK_NATIVE
+  int r = TT.native ? native(start, status) : interpx(start, status, 0);
+#else
+  int r = interpx(start, status, 0);
+#endif
   // If exit from function, TT.stack will be loaded with args etc. Clean it.
   if (r == tkexit) {
     // TODO FIXME is this safe? Just remove extra entries?
@@ -4589,6 +4632,324 @@ static int interp(int start, int *status)
   return r;
 }
 
+#ifndef FOR_TOYBOX
+////////////////////
+//// native code
+////////////////////
+
+// A program that keeps the interpreter busy for NATIVE_MS is translated to
+// C by native_save(), and later runs of the same bytecode exec 'cc -run' on
+// that instead, which tcc compiles once and then keeps in its cache. The C
+// file includes this source with WAK_NATIVE set to TT.native_key, so the
+// compiled awk parses the program again into the same tables and only the
+// dispatch loop is replaced: native() has a label per instruction, jumps
+// are gotos, the common stack and variable operations are written out, and
+// everything else is passed back to interpx() one instruction at a time.
+
+#define NATIVE_MS 100
+
+// Words in the instruction at ZCODE[pc], or 0 if native() can't run it
+static int native_len(int pc)
+{
+  switch (ZCODE[pc]) {
+    case 0: case opquit: case tknot: case opnotnot: case opnegate:
+    case tkpow: case tkmul: case tkdiv: case tkmod: case tkplus: case tkminus:
+    case tkcat: case tklt: case tkle: case tkne: case tkeq: case tkgt:
+    case tkge: case tkmatchop: case tknotmatch: case tkpowasgn:
+    case tkmodasgn: case tkmulasgn: case tkdivasgn: case tkaddasgn:
+    case tksubasgn: case tkasgn: case tkincr: case tkdecr: case oppreincr:
+    case oppredecr: case opdrop: case tkin: case opprintrec: case tkexit:
+    case tknext: case tknextfile: case opmapdelete: case tkdelete:
+      return 1;
+    case opmatchrec: case tknumber: case tkstring: case tkregex: case opdrop_n:
+    case tkfunction: case tkreturn: case opprepcall: case tkfunc:
+    case tkrbracket: case opmap: case opmapiternext: case tkvar: case tkfield:
+    case oppush: case tkand: case tkor: case tkwhile: case tkif: case tkternif:
+    case tkelse: case tkternelse: case tkbreak: case tkcontinue: case opjump:
+    case opvarref: case opmapref: case opfldref: case oprange3: case tksplit:
+    case tkmatch: case tksub: case tkgsub: case tksubstr: case tkindex:
+    case tkband: case tkbor: case tkbxor: case tklshift: case tkrshift:
+    case tktolower: case tktoupper: case tklength: case tksystem: case tkfflush:
+    case tkclose: case tksprintf: case tkatan2: case tkrand: case tksrand:
+    case tkcos: case tksin: case tkexp: case tklog: case tksqrt: case tkint:
+      return 2;
+    case tkprint: case tkprintf: case oprange1: case oprange2: case tkgetline:
+      return 3;
+  }
+  return 0;
+}
+
+// The C is made from the bytecode alone (literals stay in the table), so
+// hash that, and this source in case the interpreter changed underneath.
+static void native_init(void)
+{
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  struct arg_list *p;
+  struct stat st;
+  char buf[2] = {0};
+  FILE *fp;
+  int k, n = zlist_len(&TT.zcode);
+
+  // Only a program that can be read again, from a source that compiles
+  TT.native_key = 0;
+  for (p = TT.scs->prog_args; p; p = p->next)
+    if (stat(p->arg, &st) || !S_ISREG(st.st_mode)) return;
+  if (!(TT.native_src = realpath(TT.progname, 0))) return;
+  if (strpbrk(TT.native_src, "\"\\\n") || stat(TT.native_src, &st)) return;
+  if (!(fp = fopen(TT.native_src, "r"))) return;
+  k = fread(buf, 1, 2, fp);
+  fclose(fp);
+  if (k != 2 || memcmp(buf, "#!", 2)) return;
+
+  for (k = 0; k < n; k++) h = (h ^ ZCODE[k]) * 0x100000001b3ULL;
+  h = (h ^ st.st_dev) * 0x100000001b3ULL;
+  h = (h ^ st.st_ino) * 0x100000001b3ULL;
+  h = (h ^ st.st_size) * 0x100000001b3ULL;
+  TT.native_key = (h ^ st.st_mtime) * 0x100000001b3ULL;
+}
+
+// Next to the executables tcc caches for -run
+static char *native_path(char *buf, size_t size)
+{
+  char *dir = getenv("TCC_CACHE_DIR"), *home = getenv("HOME");
+
+  if (!TT.native_key || (dir ? !*dir : !home || !*home)) return 0;
+  if (dir) snprintf(buf, size, "%s/awk-%016llx.c", dir, TT.native_key);
+  else snprintf(buf, size, "%s/.cache/tcc/awk-%016llx.c", home,
+      TT.native_key);
+  return buf;
+}
+
+// Run the program compiled, if it was worth compiling before
+static void native_exec(int argc, char **argv)
+{
+  char path[4096], **args;
+
+  if (!native_path(path, sizeof(path)) || access(path, R_OK)) return;
+  args = xzalloc((argc + 5) * sizeof(*args));
+  args[0] = "cc";
+  args[1] = "-w";
+  args[2] = "-run";
+  args[3] = path;
+  memcpy(args + 4, argv, argc * sizeof(*args));
+  fflush(stdout);
+  execvp(*args, args);
+  xfree(args);
+}
+
+static void native_save(void)
+{
+  int n = zlist_len(&TT.zcode), *mark = xzalloc(n * sizeof(int));
+  int *todo = xzalloc(n * sizeof(int)), ntodo = 0, pc, op, op2, len, k;
+  char path[4096], tmp[4096+16], *step;
+  char *cmp[] = {"<", "<=", "!=", "==", ">", ">="};
+  FILE *fp;
+
+  if (!native_path(path, sizeof(path)) || !access(path, F_OK)) goto done;
+
+  // Find the reachable instructions (there are words in between that
+  // aren't) from the rules and functions, and where calls return to.
+  // mark: 1 is an instruction, 2 an address native() can be entered at.
+#define NATIVE_GO(a, m) \
+  do if (!mark[a]) mark[todo[ntodo++] = (a)] = (m); else mark[a] |= (m); \
+  while (0)
+  if (TT.cgl.first_begin) NATIVE_GO(TT.cgl.first_begin, 3);
+  if (TT.cgl.first_recrule) NATIVE_GO(TT.cgl.first_recrule, 3);
+  if (TT.cgl.first_end) NATIVE_GO(TT.cgl.first_end, 3);
+  for (k = 1; k < zlist_len(&TT.func_def_table); k++)
+    if (FUNC_DEF[k].flags & FUNC_DEFINED) NATIVE_GO(FUNC_DEF[k].zcode_addr, 3);
+  while (ntodo) {
+    pc = todo[--ntodo];
+    if (!(len = native_len(pc)) || pc + len > n) goto done;
+    op = ZCODE[pc];
+    op2 = ZCODE[pc + len - 1];
+    switch (op) {
+      case tkfunc:
+        NATIVE_GO(pc + 2, 3);
+        ATTR_FALLTHROUGH_INTENDED;
+      case 0: case opquit: case tkexit: case tknext: case tknextfile:
+      case tkreturn:
+        continue;
+      case tkand: case tkor: case tkwhile: case tkif: case tkternif:
+      case opmapiternext: case oprange1: case oprange2:
+        NATIVE_GO(pc + len + op2, 1);
+        break;
+      case tkelse: case tkternelse: case tkbreak: case tkcontinue: case opjump:
+        NATIVE_GO(pc + len + op2, 1);
+        continue;
+    }
+    if (pc + len >= n) goto done;
+    NATIVE_GO(pc + len, 1);
+  }
+#undef NATIVE_GO
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  if (!(fp = fopen(tmp, "w"))) goto done;
+  fprintf(fp, "// awk bytecode compiled by %s\n"
+      "#define WAK_NATIVE 0x%016llxULL\n#include \"%s\"\n\n"
+      "static int native(int start, int *status)\n{\n"
+      "  int pc = start, parmbase = 0, r, t, field_num;\n"
+      "  double nl, nr;\n  struct zvalue *v, vv;\n\n"
+      "dispatch:\n  switch (pc) {\n",
+      TT.native_src, TT.native_key, TT.native_src);
+  for (pc = 0; pc < n; pc++)
+    if (mark[pc] & 2) fprintf(fp, "    case %d: goto L%d;\n", pc, pc);
+  fprintf(fp, "  }\n  error_exit(\"!!! no native code at %%d\", pc);\n");
+
+  step = "if ((r = interpx(%d, status, &parmbase)) > 0) return r;";
+  for (pc = 0; pc < n; pc++) {
+    if (!mark[pc]) continue;
+    op = ZCODE[pc];
+    len = native_len(pc);
+    op2 = ZCODE[pc + len - 1];
+    fprintf(fp, "L%d: ", pc);
+    switch (op) {
+      case 0: case opquit:
+        fprintf(fp, "return opquit;\n");
+        continue;
+      case tknumber: case tkstring: case tkregex: case tkvar:
+        // push_val()
+        fprintf(fp, "v = &%s[%s%d];\n"
+            "  if (IS_STR(v) && v->vst) v->vst->refcnt++; *++STKP = *v;",
+            op == tkvar ? "STACK" : "LITERAL", op2 < 0 ? "parmbase + " : "",
+            op2 < 0 ? -op2 : op2);
+        break;
+      case oppush:
+        fprintf(fp, "push_int_val(%d);", op2);
+        break;
+      case opdrop:
+        fprintf(fp, "drop();");
+        break;
+      case opdrop_n:
+        fprintf(fp, "drop_n(%d);", op2);
+        break;
+      case opvarref: case opmapref:
+        fprintf(fp, "vv = (struct zvalue)ZVINIT(%s, %d, 0); push_val(&vv);",
+            op == opvarref ? "ZF_REF" : "ZF_MAPREF", op2);
+        break;
+      case tkfield:
+        fprintf(fp, "val_to_num(STKP); push_field((int)STKP->num); swap(); "
+            "drop();");
+        break;
+      case opfldref:
+        fprintf(fp, "val_to_num(STKP); STKP->flags |= ZF_FIELDREF;");
+        break;
+      case opmap:
+        fprintf(fp, "v = &STACK[%s%d]; force_maybemap_to_map(v);\n"
+            "  if (!IS_MAP(v)) FATAL(\"scalar in array context\");\n"
+            "  v = get_map_val(v, STKP); drop(); push_val(v);",
+            op2 < 0 ? "parmbase + " : "", op2 < 0 ? -op2 : op2);
+        break;
+      case tknot:
+        fprintf(fp, "STKP->num = !get_set_logical();");
+        break;
+      case opnotnot:
+        fprintf(fp, "get_set_logical();");
+        break;
+      case opnegate:
+        fprintf(fp, "val_to_num(STKP); STKP->num = -STKP->num;");
+        break;
+      case tkpow: case tkmul: case tkdiv: case tkmod: case tkplus: case tkminus:
+        fprintf(fp, "if (STKP[-1].flags == ZF_NUM && STKP->flags == ZF_NUM && "
+            "!STKP->vst)\n    nl = STKP[-1].num, nr = STKP->num, STKP--;\n"
+            "  else nl = val_to_num(STKP-1), nr = val_to_num(STKP), drop();\n"
+            "  STKP->num = %s;", op == tkpow ? "pow(nl, nr)" :
+            op == tkmod ? "fmod(nl, nr)" : op == tkmul ? "nl * nr" :
+            op == tkdiv ? "nl / nr" : op == tkplus ? "nl + nr" : "nl - nr");
+        break;
+      case tkcat:
+        fprintf(fp, "val_to_str(STKP-1); val_to_str(STKP);\n"
+            "  STKP[-1].vst = zstring_extend(STKP[-1].vst, STKP[0].vst); "
+            "drop();");
+        break;
+      case tklt: case tkle: case tkne: case tkeq: case tkgt: case tkge:
+        k = op - tklt;
+        fprintf(fp, "if (STKP[-1].flags == ZF_NUM && STKP->flags == ZF_NUM && "
+            "!STKP[-1].vst && !STKP->vst)\n"
+            "    STKP--, STKP->num = STKP->num %s STKP[1].num;\n"
+            "  else if (IS_NUM(STKP-1) && IS_NUM(STKP)) {\n"
+            "    t = STKP[-1].num %s STKP->num; drop(); drop(); "
+            "push_int_val(t);\n  } else ", cmp[k], cmp[k]);
+        fprintf(fp, step, pc);
+        break;
+      case tkpowasgn: case tkmodasgn: case tkmulasgn: case tkdivasgn:
+      case tkaddasgn: case tksubasgn:
+        fprintf(fp, "v = setup_lvalue(1, parmbase, &field_num); val_to_num(v);"
+            "\n  val_to_num(STKP); v->num = %s; drop_n(2); v->flags = ZF_NUM;"
+            "\n  push_val(v); if (field_num >= 0) fixup_fields(field_num);",
+            op == tkpowasgn ? "pow(v->num, STKP->num)" : op == tkmodasgn ?
+            "fmod(v->num, STKP->num)" : op == tkmulasgn ? "v->num * STKP->num"
+            : op == tkdivasgn ? "v->num / STKP->num" : op == tkaddasgn ?
+            "v->num + STKP->num" : "v->num - STKP->num");
+        break;
+      case tkasgn:
+        fprintf(fp, "v = setup_lvalue(1, parmbase, &field_num);\n"
+            "  force_maybemap_to_scalar(STKP); zvalue_copy(v, STKP); swap(); "
+            "drop();\n  if (field_num >= 0) fixup_fields(field_num);");
+        break;
+      case tkincr: case tkdecr: case oppreincr: case oppredecr:
+        k = op == tkincr || op == oppreincr ? 1 : -1;
+        fprintf(fp, "v = setup_lvalue(0, parmbase, &field_num); val_to_num(v);"
+            "\n  v->flags = ZF_NUM; v->num += %d; push_val(v);", k);
+        if (op == tkincr || op == tkdecr) fprintf(fp, " STKP->num -= %d;", k);
+        fprintf(fp, "\n  swap(); drop(); "
+            "if (field_num >= 0) fixup_fields(field_num);");
+        break;
+      case tkand: case tkor:
+        fprintf(fp, "if (%sget_set_logical()) drop(); else goto L%d;",
+            op == tkand ? "" : "!", pc + len + op2);
+        break;
+      case tkwhile:
+        fprintf(fp, "STKP->num = !get_set_logical();\n  ");
+        ATTR_FALLTHROUGH_INTENDED;
+      case tkif: case tkternif:
+        fprintf(fp, "if (STKP->flags == ZF_NUM && !STKP->vst) "
+            "t = STKP--->num != 0;\n"
+            "  else t = get_set_logical(), drop();\n  if (!t) goto L%d;",
+            pc + len + op2);
+        break;
+      case tkelse: case tkternelse: case tkbreak: case tkcontinue: case opjump:
+        fprintf(fp, "goto L%d;\n", pc + len + op2);
+        continue;
+      case oprange1:
+        fprintf(fp, "if (TT.range_sw[%d]) goto L%d;", ZCODE[pc + 1],
+            pc + len + op2);
+        break;
+      case oprange2:
+        fprintf(fp, "t = get_set_logical(); drop();\n"
+            "  if (t) TT.range_sw[%d] = 1; else goto L%d;", ZCODE[pc + 1],
+            pc + len + op2);
+        break;
+      case oprange3:
+        fprintf(fp, "t = get_set_logical(); drop(); "
+            "if (t) TT.range_sw[%d] = 0;", op2);
+        break;
+      case opmapiternext:
+        fprintf(fp, step, pc);
+        fprintf(fp, "\n  if (r != -%d) goto L%d;", pc + len, pc + len + op2);
+        break;
+      case tkexit: case tknext: case tknextfile:
+        fprintf(fp, "return interpx(%d, status, &parmbase);\n", pc);
+        continue;
+      case tkfunc: case tkreturn:
+        fprintf(fp, step, pc);
+        fprintf(fp, "\n  pc = -r; goto dispatch;\n");
+        continue;
+      default:
+        fprintf(fp, step, pc);
+    }
+    fprintf(fp, "\n");
+    if (!mark[pc + len]) fprintf(fp, "  goto L%d;\n", pc + len);
+  }
+  fprintf(fp, "}\n");
+  if (fclose(fp) || rename(tmp, path)) unlink(tmp);
+
+done:
+  xfree(todo);
+  xfree(mark);
+}
+#endif  // FOR_TOYBOX
+
 static void insert_argv_map(struct zvalue *map, int key, char *value)
 {
   struct zvalue zkey = ZVINIT(ZF_STR, 0, num_to_zstring(key, ENSURE_STR(&STACK[CONVFMT])->vst->str));
@@ -4722,13 +5083,20 @@ static void run(int optind, int argc, char **argv, char *sepstring,
   new_file("/dev/stderr", stderr, 'w', 'f')->is_std_file = 1;
   seedrand(123);
   int status = -1, r = 0;
+#ifndef FOR_TOYBOX
+  long start = millinow();
+#endif
   if (TT.cgl.first_begin) r = interp(TT.cgl.first_begin, &status);
   if (r != tkexit)
     if (TT.cgl.first_recrule) run_files(&status);
   if (TT.cgl.first_end) r = interp(TT.cgl.first_end, &status);
+#ifndef FOR_TOYBOX
+  if (!TT.native && millinow() - start >= NATIVE_MS) native_save();
+#endif
   regfree(&TT.rx_printf_fmt);
   regfree(&TT.rx_default);
   regfree(&TT.rx_last);
+  if (*TT.rs_last) regfree(&TT.rx_rs_last);
   free_literal_regex();
   close_file(0);    // close all files
   if (status >= 0) exit(status);
@@ -4762,6 +5130,16 @@ static int awk(char *sepstring, char *progstring, struct arg_list *prog_args,
   if (TT.cgl.compile_error_count)
     error_exit("%d syntax error(s)", TT.cgl.compile_error_count);
   else {
+#ifndef FOR_TOYBOX
+    if (opt_run_prog) {
+      native_init();
+#ifdef WAK_NATIVE
+      TT.native = TT.native_key == WAK_NATIVE;
+#else
+      native_exec(argc, argv);
+#endif
+    }
+#endif
     if (opt_run_prog)
       run(optind, argc, argv, sepstring, assign_args);
   }
@@ -4800,6 +5178,10 @@ int main(int argc, char **argv)
       "-c compile only, do not run\n"
   };
   char pbuf[PBUFSIZE];
+#ifdef WAK_NATIVE
+  // Run by native_exec() as: cc -run <C file> <awk> <args>...
+  argc--, argv++;
+#endif
   TT.pbuf = pbuf;
   TT.progname = argv[0];
   char *sepstring = " ";
@@ -0,0 +1,20 @@
+/*
+ * The hash used by the dispatch table.  mkdispatch builds the table with
+ * it, and the dispatch.h it writes includes this file to look names up,
+ * so the two always agree.  DISPATCHSIZE and DISPATCHBUCKETS must be
+ * defined first.
+ */
+
+static inline unsigned long long
+dispatchhash(const char *p)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	while (*p)
+		h = (h ^ (unsigned char)*p++) * 1099511628211ULL;
+	return h;
+}
+
+#define DISPATCHBUCKET(h)	((h) >> 40 & (DISPATCHBUCKETS - 1))
+#define DISPATCHSLOT(h, d)	\
+	(((h) + (d) * ((h) >> 32 | 1)) & (DISPATCHSIZE - 1))
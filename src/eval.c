@@ -99,6 +99,9 @@ STATIC int evalcommand(union node *, int);
 #endif
 STATIC int evalbltin(const struct builtincmd *, int, char **, int);
 STATIC int evalfun(struct funcnode *, int, char **, int);
+#ifndef USE_GLIBC_STDIO
+STATIC int evalbackbltin(union node *, struct backcmd *);
+#endif
 STATIC void prehash(union node *);
 STATIC int eprintlist(struct output *, struct strlist *, int);
 STATIC int bltincmd(int, char **);
@@ -634,6 +637,10 @@ evalbackcmd(union node *n, struct backcmd *result)
 	if (n == NULL) {
 		goto out;
 	}
+#ifndef USE_GLIBC_STDIO
+	if (evalbackbltin(n, result))
+		goto out;
+#endif
 
 	if (pipe(pip) < 0)
 		sh_error("Pipe call failed");
@@ -658,6 +665,106 @@ out:
 		result->fd, result->buf, result->nleft, result->jp));
 }
 
+#ifndef USE_GLIBC_STDIO
+/*
+ * Check that expanding a word has no side effects and cannot fail: no
+ * command or arithmetic substitution, ${var=...} or ${var?...}.
+ */
+
+STATIC int
+purearg(union node *n)
+{
+	char *p;
+	int subtype;
+
+	if (n->narg.backquote)
+		return 0;
+	for (p = n->narg.text; *p; p++) {
+		switch ((signed char)*p) {
+		case CTLESC:
+			p++;
+			break;
+		case CTLVAR:
+			subtype = p[1] & VSTYPE;
+			if (subtype == VSASSIGN || subtype == VSQUESTION)
+				return 0;
+			break;
+		case CTLBACKQ:
+		case CTLARI:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Evaluate a command substitution in the shell itself if it is a single
+ * simple command running a builtin that only produces output, with no
+ * assignments or redirections and pure arguments.  The output goes to
+ * memory.  Returns 0 if a subshell is needed after all; since the
+ * arguments are pure, expanding them again there does no harm.
+ */
+
+STATIC int
+evalbackbltin(union node *n, struct backcmd *result)
+{
+	struct arglist arglist;
+	struct cmdentry entry;
+	const struct builtincmd *cmd;
+	struct strlist *sp;
+	union node *argp;
+	char **argv;
+	int argc;
+	int savestatus;
+	int saveint;
+	int i;
+
+	if (n->type != NCMD || n->ncmd.assign || n->ncmd.redirect ||
+	    xflag || uflag)
+		return 0;
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next)
+		if (!purearg(argp))
+			return 0;
+
+	arglist.lastp = &arglist.list;
+	expandargs(n->ncmd.args, &arglist);
+	*arglist.lastp = NULL;
+	if (!arglist.list)
+		return 0;
+
+	cmd = find_builtin(arglist.list->text);
+	if (cmd != ECHOCMD && cmd != PRINTFCMD && cmd != PWDCMD &&
+	    cmd != TRUECMD && cmd != FALSECMD)
+		return 0;
+	find_command(arglist.list->text, &entry, 0, pathval());
+	if (entry.cmdtype != CMDBUILTIN || entry.u.cmd != cmd)
+		return 0;
+
+	argc = 0;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argc++;
+	argv = stalloc(sizeof(char *) * (argc + 1));
+	for (i = 0, sp = arglist.list; sp; sp = sp->next)
+		argv[i++] = sp->text;
+	argv[i] = NULL;
+
+	savestatus = exitstatus;
+	SAVEINT(saveint);
+	pushmemout();
+	i = evalbltin(cmd, argc, argv, 0);
+	result->nleft = popmemout(&result->buf);
+	RESTOREINT(saveint);
+	back_exitstatus = exitstatus;
+	exitstatus = savestatus;
+	if (i && exception != EXERROR) {
+		ckfree(result->buf);
+		result->buf = NULL;
+		longjmp(handler->loc, 1);
+	}
+	return 1;
+}
+#endif
+
 static struct strlist *fill_arglist(struct arglist *arglist,
 				    union node **argpp)
 {
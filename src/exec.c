@@ -38,6 +38,7 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 #ifdef HAVE_PATHS_H
 #include <paths.h>
 #endif
@@ -59,6 +60,7 @@
 #include "eval.h"
 #include "exec.h"
 #include "builtins.h"
+#include "dispatch.h"
 #include "var.h"
 #include "options.h"
 #include "output.h"
@@ -73,7 +75,7 @@
 #include "system.h"
 
 
-#define CMDTABLESIZE 31		/* should be prime */
+#define CMDTABLESIZE 64		/* initial size, a power of two */
 #define ARB 1			/* actual size determined at run time */
 
 
@@ -87,7 +89,10 @@ struct tblentry {
 };
 
 
-STATIC struct tblentry *cmdtable[CMDTABLESIZE];
+STATIC struct tblentry *cmdtable0[CMDTABLESIZE];
+STATIC struct tblentry **cmdtable = cmdtable0;
+STATIC unsigned cmdtabsize = CMDTABLESIZE;
+STATIC unsigned ncmds;
 STATIC int builtinloc = -1;		/* index in path of %builtin, or -1 */
 
 
@@ -107,6 +112,19 @@ int ar_main(int argc, char *argv[]);
 int samu_main(int argc, char *argv[]);
 
 
+/*
+ * Is this a command that shellexec runs without exec'ing another program?
+ */
+
+int
+inbinary(const char *name)
+{
+	const struct dispatch *dp = finddispatch(name);
+
+	return dp && (dp->toy >= 0 || dp->prog);
+}
+
+
 /*
  * Exec a program.  Never returns.  If you change this routine, you may
  * have to change the find_command routine as well.
@@ -120,37 +138,30 @@ shellexec(char **argv, const char *path, int idx)
 	char **envp;
 	int exerrno;
 	int argc;
+	const struct dispatch *dp;
 	for (argc = 0; argv[argc]; argc++);
 
 	envp = environment();
 
-	for (int i = 0; envp[i]; i++) {
-		char name[strlen(envp[i])+1];
-		strcpy(name, envp[i]);
-		char *eq = strchr(name, '=');
-		if (eq) {
-			*eq = '\0';
-			if (strcmp(name, "PWD") == 0) continue;
-			setenv(name, eq+1, 1);
+	/*
+	 * Commands built into the binary see the exported variables as
+	 * environ.  This is never a vforked child, whose environ would be
+	 * the parent's.
+	 */
+	dp = finddispatch(argv[0]);
+	if (dp && (dp->toy >= 0 || dp->prog)) {
+		environ = binaryenvironment();
+		switch (dp->prog) {
+		case DISPATCH_TCC:
+			exit(tcc_main(argc, argv));
+		case DISPATCH_AR:
+			exit(ar_main(argc, argv));
+		case DISPATCH_SAMU:
+			exit(samu_main(argc, argv));
 		}
-	}
-
-	if (toy_find(argv[0])) {
 		toy_exec(argv);
 	}
 
-	if (!strcmp(argv[0], "cc") || !strcmp(argv[0], "c99") || !strcmp(argv[0], "ld")) {
-		exit(tcc_main(argc, argv));
-	}
-
-	if (!strcmp(argv[0], "ar")) {
-		exit(ar_main(argc, argv));
-	}
-
-	if (!strcmp(argv[0], "samu") || !strcmp(argv[0], "ninja")) {
-		exit(samu_main(argc, argv));
-	}
-
 	if (strchr(argv[0], '/') != NULL) {
 		tryexec(argv[0], argv, envp);
 		e = errno;
@@ -320,7 +331,7 @@ hashcmd(int argc, char **argv)
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+		for (pp = cmdtable ; pp < &cmdtable[cmdtabsize] ; pp++) {
 			for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -354,10 +365,14 @@ printentry(struct tblentry *cmdp)
 
 	idx = cmdp->param.index;
 	path = pathval();
-	do {
-		padvance(&path, cmdp->cmdname);
-	} while (--idx >= 0);
-	name = stackblock();
+	if (idx < 0)
+		name = cmdp->cmdname;
+	else {
+		do {
+			padvance(&path, cmdp->cmdname);
+		} while (--idx >= 0);
+		name = stackblock();
+	}
 	out1str(name);
 	out1fmt(snlfmt, cmdp->rehash ? "*" : nullstr);
 }
@@ -532,11 +547,19 @@ loop:
 		goto success;
 	}
 
-	if (toy_find(name) || !strcmp(name, "cc") || !strcmp(name, "c99") || !strcmp(name, "ld") ||
-	    !strcmp(name, "ar") || !strcmp(name, "samu") || !strcmp(name, "ninja")) {
-		entry->u.index = -1;
-		entry->cmdtype = CMDNORMAL;
-		return;
+	/* Commands built into the binary are hashed with index -1 */
+	if (inbinary(name)) {
+		if (!updatetbl) {
+			entry->u.index = -1;
+			entry->cmdtype = CMDNORMAL;
+			return;
+		}
+		INTOFF;
+		cmdp = cmdlookup(name, 1);
+		cmdp->cmdtype = CMDNORMAL;
+		cmdp->param.index = -1;
+		INTON;
+		goto success;
 	}
 
 	/* We failed.  If there was an entry for this command, delete it */
@@ -574,13 +597,68 @@ success:
 struct builtincmd *
 find_builtin(const char *name)
 {
-	struct builtincmd *bp;
+	const struct dispatch *dp = finddispatch(name);
 
-	bp = bsearch(
-		&name, builtincmd, NUMBUILTINS, sizeof(struct builtincmd),
-		pstrcmp
-	);
-	return bp;
+	return dp && dp->builtin >= 0 ?
+	       (struct builtincmd *)&builtincmd[dp->builtin] : NULL;
+}
+
+
+
+/*
+ * bootsh --bench-dispatch [count [name...]]: time looking up each name
+ * in the dispatch table, through find_command with the command hashed,
+ * and through find_command with a copy of PATH, which searches PATH
+ * every time.  Prints nanoseconds per lookup.
+ */
+
+static long
+benchns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int
+benchdispatch(int argc, char **argv)
+{
+	static char *names[] = {
+		"echo", "[", "cat", "sed", "toybox", "cc", "ninja",
+		"nosuchcommand", NULL
+	};
+	struct cmdentry entry;
+	char **ap;
+	const char *path;
+	long count, i, t0, t1, t2, t3;
+	volatile const void *sink;
+
+	count = argc > 2 ? atol(argv[2]) : 100000;
+	if (count <= 0)
+		count = 1;
+	ap = argc > 3 ? argv + 3 : names;
+	path = savestr(pathval());
+	out1fmt("%-16s %10s %12s %12s\n",
+		"name", "dispatch", "hashed", "unhashed");
+	for (; *ap; ap++) {
+		t0 = benchns();
+		for (i = 0; i < count; i++)
+			sink = finddispatch(*ap);
+		t1 = benchns();
+		for (i = 0; i < count; i++)
+			find_command(*ap, &entry, 0, pathval());
+		t2 = benchns();
+		for (i = 0; i < count / 100 + 1; i++)
+			find_command(*ap, &entry, 0, path);
+		t3 = benchns();
+		out1fmt("%-16s %8ld ns %9ld ns %9ld ns\n", *ap,
+			(t1 - t0) / count, (t2 - t1) / count,
+			(t3 - t2) / (count / 100 + 1));
+	}
+	(void)sink;
+	flushall();
+	return 0;
 }
 
 
@@ -596,7 +674,7 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable ; pp < &cmdtable[CMDTABLESIZE] ; pp++) {
+	for (pp = cmdtable ; pp < &cmdtable[cmdtabsize] ; pp++) {
 		for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL || (
 				cmdp->cmdtype == CMDBUILTIN &&
@@ -656,7 +734,7 @@ clearcmdentry(void)
 	struct tblentry *cmdp;
 
 	INTOFF;
-	for (tblp = cmdtable ; tblp < &cmdtable[CMDTABLESIZE] ; tblp++) {
+	for (tblp = cmdtable ; tblp < &cmdtable[cmdtabsize] ; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if (cmdp->cmdtype == CMDNORMAL ||
@@ -665,6 +743,7 @@ clearcmdentry(void)
 			     builtinloc > 0)) {
 				*pp = cmdp->next;
 				ckfree(cmdp);
+				ncmds--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -688,20 +767,62 @@ clearcmdentry(void)
 struct tblentry **lastcmdentry;
 
 
+STATIC unsigned int
+hashcmdname(const char *p)
+{
+	unsigned int hashval;
+
+	/* FNV-1a */
+	hashval = 2166136261u;
+	while (*p)
+		hashval = (hashval ^ (unsigned char)*p++) * 16777619;
+	return hashval;
+}
+
+
+/*
+ * Double the size of the table once it holds as many entries as it
+ * has slots.
+ */
+
+STATIC void
+growcmdtable(void)
+{
+	struct tblentry **old;
+	struct tblentry **pp;
+	struct tblentry *cmdp;
+	struct tblentry *next;
+	unsigned oldsize, i;
+
+	old = cmdtable;
+	oldsize = cmdtabsize;
+	cmdtabsize <<= 1;
+	cmdtable = ckmalloc(cmdtabsize * sizeof(*cmdtable));
+	memset(cmdtable, 0, cmdtabsize * sizeof(*cmdtable));
+	for (i = 0; i < oldsize; i++) {
+		for (cmdp = old[i]; cmdp; cmdp = next) {
+			next = cmdp->next;
+			pp = &cmdtable[hashcmdname(cmdp->cmdname) &
+				       (cmdtabsize - 1)];
+			cmdp->next = *pp;
+			*pp = cmdp;
+		}
+	}
+	if (old != cmdtable0)
+		ckfree(old);
+}
+
+
 STATIC struct tblentry *
 cmdlookup(const char *name, int add)
 {
-	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	/* grow first, as lastcmdentry points into the table */
+	if (add && ncmds >= cmdtabsize)
+		growcmdtable();
+	pp = &cmdtable[hashcmdname(name) & (cmdtabsize - 1)];
 	for (cmdp = *pp ; cmdp ; cmdp = cmdp->next) {
 		if (equal(cmdp->cmdname, name))
 			break;
@@ -713,6 +834,7 @@ cmdlookup(const char *name, int add)
 		cmdp->next = NULL;
 		cmdp->cmdtype = CMDUNKNOWN;
 		strcpy(cmdp->cmdname, name);
+		ncmds++;
 	}
 	lastcmdentry = pp;
 	return cmdp;
@@ -733,6 +855,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	ckfree(cmdp);
+	ncmds--;
 	INTON;
 }
 
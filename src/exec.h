@@ -64,12 +64,14 @@ extern const char *pathopt;	/* set by padvance */
 
 struct stat64;
 
+int inbinary(const char *);
 void shellexec(char **, const char *, int)
     __attribute__((__noreturn__));
 int padvance_magic(const char **path, const char *name, int magic);
 int hashcmd(int, char **);
 void find_command(char *, struct cmdentry *, int, const char *);
 struct builtincmd *find_builtin(const char *);
+int benchdispatch(int, char **);
 void hashcd(void);
 void changepath(const char *);
 #ifdef notdef
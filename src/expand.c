@@ -221,6 +221,30 @@ out:
 }
 
 
+/*
+ * Expand a list of words in the middle of expanding another one, for
+ * a command substitution that is evaluated without forking.
+ */
+
+void
+expandargs(union node *argp, struct arglist *arglist)
+{
+	char *savedest = expdest;
+	struct nodelist *saveargbackq = argbackq;
+	struct ifsregion saveifsfirst = ifsfirst;
+	struct ifsregion *saveifslastp = ifslastp;
+
+	ifsfirst.next = NULL;
+	ifslastp = NULL;
+	for (; argp; argp = argp->narg.next)
+		expandarg(argp, arglist, EXP_FULL | EXP_TILDE);
+	expdest = savedest;
+	argbackq = saveargbackq;
+	ifsfirst = saveifsfirst;
+	ifslastp = saveifslastp;
+}
+
+
 
 /*
  * Perform variable and command substitution.  If EXP_FULL is set, output CTLESC
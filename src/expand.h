@@ -66,6 +66,7 @@ struct jmploc;
 union node;
 
 void expandarg(union node *, struct arglist *, int);
+void expandargs(union node *, struct arglist *);
 #define rmescapes(p) _rmescapes((p), 0)
 char *_rmescapes(char *, int);
 int casematch(union node *, char *);
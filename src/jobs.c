@@ -69,6 +69,7 @@
 #include "output.h"
 #include "memalloc.h"
 #include "error.h"
+#include "var.h"
 #include "mystring.h"
 #include "system.h"
 
@@ -978,6 +979,19 @@ struct job *vforkexec(union node *n, char **argv, const char *path, int idx)
 
 	jp = makejob(1);
 
+	/*
+	 * Commands built into the binary run in the child without exec,
+	 * which would clobber our memory after vfork.
+	 */
+	if (inbinary(argv[0])) {
+		if (forkshell(jp, n, FORK_FG) == 0)
+			shellexec(argv, path, idx);
+		return jp;
+	}
+
+	/* Build the environment here so the child need not allocate. */
+	environment();
+
 	sigblockall(NULL);
 	vforked++;
 
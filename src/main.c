@@ -61,13 +61,6 @@
 #include "cd.h"
 #include "builtins.h"
 
-#include "libtcc1a.h"
-
-const char* libtcc1a = NULL;
-const int libtcc1a_len = LIBTCC1A_LEN;
-
-long long gunzip_mem(char *inbuf, int inlen, char *outbuf, int outlen);
-
 void list_toys(void);
 
 #define PROFILE 0
@@ -104,10 +97,6 @@ main(int argc, char **argv)
 	struct stackmark smark;
 	int login;
 
-	char *outbuf = malloc(LIBTCC1A_LEN);
-	gunzip_mem(libtcc1a_data, sizeof(libtcc1a_data), outbuf, LIBTCC1A_LEN);
-	libtcc1a = outbuf;
-
 	if (argc > 1 && strcmp(argv[1], "--list-builtins") == 0) {
 		puts("ar");
 		puts("cc");
@@ -174,6 +163,8 @@ main(int argc, char **argv)
 #endif
 	rootpid = getpid();
 	init();
+	if (argc > 1 && strcmp(argv[1], "--bench-dispatch") == 0)
+		return benchdispatch(argc, argv);
 	setstackmark(&smark);
 	login = procargs(argc, argv);
 	if (login) {
@@ -41,6 +41,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -61,6 +62,26 @@
 
 #undef rflag
 
+/* Where read gets its input from: one byte at a time, or buffered. */
+#define RD_BYTE 0
+#define RD_FILE 1
+#define RD_PIPE 2
+
+/* Scratch pipe that read tees a pipe on stdin into, to look ahead. */
+int readpipe[2] = { -1, -1 };
+
+#ifdef mkinit
+INCLUDE <unistd.h>
+INCLUDE "miscbltin.h"
+
+FORKRESET {
+	if (readpipe[0] >= 0) {
+		close(readpipe[0]);
+		close(readpipe[1]);
+		readpipe[0] = readpipe[1] = -1;
+	}
+}
+#endif
 
 /** handle one line of the read command.
  *  more fields than variables -> remainder shall be part of last variable.
@@ -104,18 +125,122 @@ readcmd_handle_line(char *s, int ac, char **ap)
 	} while (*++ap);
 }
 
+/*
+ * Pick how read takes its input.  A regular file is read in blocks and
+ * the unused tail given back with lseek.  A pipe is peeked at with tee
+ * into a scratch pipe, and only the bytes that were used get read from
+ * it.  Anything else, a terminal say, is read a byte at a time.
+ */
+
+static int
+readmode(void)
+{
+	struct stat st;
+	int fds[2];
+
+	if (fstat(0, &st) < 0)
+		return RD_BYTE;
+	if (S_ISREG(st.st_mode))
+		return RD_FILE;
+	if (!S_ISFIFO(st.st_mode))
+		return RD_BYTE;
+	if (readpipe[0] >= 0)
+		return RD_PIPE;
+
+	INTOFF;
+	if (pipe(fds) == 0) {
+		readpipe[0] = fcntl(fds[0], F_DUPFD_CLOEXEC, 10);
+		readpipe[1] = fcntl(fds[1], F_DUPFD_CLOEXEC, 10);
+		close(fds[0]);
+		close(fds[1]);
+		if (readpipe[0] < 0 || readpipe[1] < 0) {
+			if (readpipe[0] >= 0)
+				close(readpipe[0]);
+			if (readpipe[1] >= 0)
+				close(readpipe[1]);
+			readpipe[0] = readpipe[1] = -1;
+		}
+	}
+	INTON;
+	return readpipe[0] < 0 ? RD_BYTE : RD_PIPE;
+}
+
+/*
+ * Fill buf with up to len bytes of stdin.  In pipe mode they are only
+ * peeked at; if that fails for any reason but a signal, drop to reading
+ * bytes, which is always safe as nothing has been consumed.
+ */
+
+static int
+readfill(int *mode, char *buf, int len)
+{
+	int n, m, i;
+
+	switch (*mode) {
+	case RD_FILE:
+		return read(0, buf, len);
+	case RD_PIPE:
+		n = tee(0, readpipe[1], len, 0);
+		if (n < 0 && errno == EINTR)
+			return n;
+		for (m = 0; n > 0 && m < n; m += i) {
+			i = read(readpipe[0], buf + m, n - m);
+			if (i < 0 && errno == EINTR)
+				i = 0;
+			else if (i <= 0)
+				break;
+		}
+		if (n >= 0 && m == n)
+			return n;
+		INTOFF;
+		close(readpipe[0]);
+		close(readpipe[1]);
+		readpipe[0] = readpipe[1] = -1;
+		INTON;
+		*mode = RD_BYTE;
+	}
+	return read(0, buf, 1);
+}
+
+/*
+ * Account for the first used of the avail bytes readfill returned:
+ * give the rest back to a file, or consume them from a pipe.
+ */
+
+static void
+readsync(int mode, char *buf, int used, int avail)
+{
+	int n;
+
+	if (mode == RD_FILE && used < avail)
+		lseek(0, used - avail, SEEK_CUR);
+	else if (mode == RD_PIPE)
+		while (used > 0) {
+			n = read(0, buf, used);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			used -= n;
+		}
+}
+
 /*
  * The read builtin.  The -e option causes backslashes to escape the
  * following character. The -p option followed by an argument prompts
  * with the argument.
  *
- * This uses unbuffered input, which may be avoidable in some cases.
+ * Input is buffered where readmode allows it, without consuming
+ * anything past the end of the line.  The buffer starts small and grows
+ * when a line spans refills, so short lines don't read far ahead.
  */
 
 int
 readcmd(int argc, char **argv)
 {
 	char **ap;
+	char buf[4096];
+	char *bp, *be;
 	char c;
 	int rflag;
 	char *prompt;
@@ -123,6 +248,8 @@ readcmd(int argc, char **argv)
 	int startloc;
 	int newloc;
 	int status;
+	int mode;
+	int len;
 	int i;
 
 	rflag = 0;
@@ -143,22 +270,29 @@ readcmd(int argc, char **argv)
 		sh_error("arg count");
 
 	status = 0;
+	mode = readmode();
+	len = 128;
+	bp = be = buf;
 	STARTSTACKSTR(p);
 
 	goto start;
 
 	for (;;) {
-		switch (read(0, &c, 1)) {
-		case 1:
-			break;
-		default:
-			if (errno == EINTR && !pending_sig)
-				continue;
-				/* fall through */
-		case 0:
-			status = 1;
-			goto out;
+		if (bp == be) {
+			readsync(mode, buf, be - buf, be - buf);
+			bp = be = buf;
+			i = readfill(&mode, buf, len);
+			if (i <= 0) {
+				if (i < 0 && errno == EINTR && !pending_sig)
+					continue;
+				status = 1;
+				goto out;
+			}
+			be = buf + i;
+			if (len < sizeof(buf))
+				len <<= 1;
 		}
+		c = *bp++;
 		if (c == '\0')
 			continue;
 		if (newloc >= startloc) {
@@ -187,6 +321,7 @@ start:
 		}
 	}
 out:
+	readsync(mode, buf, bp - buf, be - buf);
 	recordregion(startloc, p - (char *)stackblock(), 0);
 	STACKSTRNUL(p);
 	readcmd_handle_line(p + 1, argc - (ap - argv), ap);
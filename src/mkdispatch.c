@@ -0,0 +1,258 @@
+/*
+ * This program creates dispatch.h and dispatch.c, a perfect hash table
+ * of every command name that runs without exec'ing another program:
+ * the shell's builtins (read from the builtins.c made by mkbuiltins),
+ * the configured toybox commands, and tcc, ar and samu.
+ *
+ * Names hash into buckets, and each bucket gets the first displacement
+ * that puts all of its names in empty slots, biggest buckets first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/toybox/generated/config.h"
+#include "dispatchhash.h"
+
+#define MAXNAMES 1024
+
+static const char *toys[] = {
+#undef NEWTOY
+#undef OLDTOY
+#define NEWTOY(name, opts, flags) #name,
+#define OLDTOY(name, oldname, flags) #name,
+#include "../lib/toybox/generated/newtoys.h"
+};
+
+static const struct {
+	const char *name;
+	const char *prog;
+} progs[] = {
+	{ "cc",		"DISPATCH_TCC" },
+	{ "c99",	"DISPATCH_TCC" },
+	{ "ld",		"DISPATCH_TCC" },
+	{ "ar",		"DISPATCH_AR" },
+	{ "samu",	"DISPATCH_SAMU" },
+	{ "ninja",	"DISPATCH_SAMU" },
+};
+
+struct name {
+	char *name;
+	int builtin;
+	int toy;
+	const char *prog;
+	unsigned long long hash;
+};
+
+static char writer[] = "\
+/*\n\
+ * This file was generated by the mkdispatch program.\n\
+ */\n\
+\n";
+
+static struct name names[MAXNAMES];
+static int nnames;
+static unsigned size;
+static unsigned nbuckets;
+static int *slot;
+static unsigned *disp;
+
+#define DISPATCHBUCKETS nbuckets
+#define DISPATCHSIZE size
+
+static struct name *
+add(const char *name)
+{
+	struct name *np;
+
+	for (np = names; np < names + nnames; np++)
+		if (!strcmp(np->name, name))
+			return np;
+	if (nnames == MAXNAMES) {
+		fputs("mkdispatch: too many names\n", stderr);
+		exit(2);
+	}
+	np->name = strdup(name);
+	np->builtin = -1;
+	np->toy = -1;
+	np->prog = "0";
+	np->hash = dispatchhash(name);
+	nnames++;
+	return np;
+}
+
+/*
+ * Read the names of builtincmd[] in order from builtins.c.
+ */
+
+static void
+readbuiltins(const char *file)
+{
+	FILE *fp;
+	char line[256];
+	char *p, *q;
+	int i = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		perror(file);
+		exit(2);
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "\t{ \"", 4))
+			continue;
+		p = line + 4;
+		if ((q = strchr(p, '"')) == NULL)
+			continue;
+		*q = '\0';
+		add(p)->builtin = i++;
+	}
+	fclose(fp);
+}
+
+static int
+bucketsize(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+	int nx = 0, ny = 0, i;
+
+	for (i = 0; i < nnames; i++) {
+		nx += DISPATCHBUCKET(names[i].hash) == x;
+		ny += DISPATCHBUCKET(names[i].hash) == y;
+	}
+	return ny - nx;
+}
+
+/*
+ * Find a displacement for each bucket.
+ */
+
+static void
+place(void)
+{
+	unsigned *order;
+	unsigned b, d, s;
+	int i, j, n, members[MAXNAMES];
+
+	slot = malloc(size * sizeof(*slot));
+	disp = calloc(nbuckets, sizeof(*disp));
+	order = malloc(nbuckets * sizeof(*order));
+	for (s = 0; s < size; s++)
+		slot[s] = -1;
+	for (b = 0; b < nbuckets; b++)
+		order[b] = b;
+	qsort(order, nbuckets, sizeof(*order), bucketsize);
+
+	for (b = 0; b < nbuckets; b++) {
+		n = 0;
+		for (i = 0; i < nnames; i++)
+			if (DISPATCHBUCKET(names[i].hash) == order[b])
+				members[n++] = i;
+		if (!n)
+			break;
+		for (d = 0; d < 65536; d++) {
+			for (i = 0; i < n; i++) {
+				s = DISPATCHSLOT(names[members[i]].hash, d);
+				if (slot[s] >= 0)
+					break;
+				slot[s] = members[i];
+			}
+			if (i == n)
+				break;
+			for (j = 0; j < i; j++)
+				slot[DISPATCHSLOT(names[members[j]].hash, d)] = -1;
+		}
+		if (d == 65536) {
+			fputs("mkdispatch: no displacement found\n", stderr);
+			exit(2);
+		}
+		disp[order[b]] = d;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *cfile, *hfile;
+	struct name *np;
+	unsigned i;
+
+	if (argc != 2) {
+		fputs("usage: mkdispatch builtins.c\n", stderr);
+		exit(2);
+	}
+	readbuiltins(argv[1]);
+	for (i = 0; i < sizeof(toys) / sizeof(*toys); i++)
+		add(toys[i])->toy = i;
+	for (i = 0; i < sizeof(progs) / sizeof(*progs); i++)
+		add(progs[i].name)->prog = progs[i].prog;
+
+	/* half full, about four names to a bucket */
+	for (size = 16; size < 2 * nnames; size <<= 1)
+		;
+	nbuckets = size / 8;
+	place();
+
+	if ((hfile = fopen("dispatch.h", "w")) == NULL) {
+		perror("dispatch.h");
+		exit(2);
+	}
+	if ((cfile = fopen("dispatch.c", "w")) == NULL) {
+		perror("dispatch.c");
+		exit(2);
+	}
+
+	fputs(writer, hfile);
+	fputs("#include <string.h>\n\n", hfile);
+	fprintf(hfile, "#define DISPATCHSIZE %u\n", size);
+	fprintf(hfile, "#define DISPATCHBUCKETS %u\n", nbuckets);
+	fputs("\n"
+	      "#define DISPATCH_TCC 1\n"
+	      "#define DISPATCH_AR 2\n"
+	      "#define DISPATCH_SAMU 3\n"
+	      "\n"
+	      "struct dispatch {\n"
+	      "\tconst char *name;\n"
+	      "\tshort builtin;\t/* index in builtincmd[], or -1 */\n"
+	      "\tshort toy;\t/* index in toy_list[], or -1 */\n"
+	      "\tshort prog;\t/* DISPATCH_TCC, _AR, _SAMU or 0 */\n"
+	      "};\n"
+	      "\n"
+	      "extern const struct dispatch dispatchtab[];\n"
+	      "extern const unsigned short dispatchdisp[];\n"
+	      "\n"
+	      "#include \"dispatchhash.h\"\n", hfile);
+	fputs("\n"
+	      "static inline const struct dispatch *\n"
+	      "finddispatch(const char *name)\n"
+	      "{\n"
+	      "\tunsigned long long h = dispatchhash(name);\n"
+	      "\tconst struct dispatch *dp;\n"
+	      "\n"
+	      "\tdp = &dispatchtab[DISPATCHSLOT(h, "
+	      "dispatchdisp[DISPATCHBUCKET(h)])];\n"
+	      "\treturn dp->name && !strcmp(dp->name, name) ? dp : 0;\n"
+	      "}\n", hfile);
+
+	fputs(writer, cfile);
+	fputs("#include \"dispatch.h\"\n"
+	      "\n"
+	      "const struct dispatch dispatchtab[DISPATCHSIZE] = {\n", cfile);
+	for (i = 0; i < size; i++) {
+		if (slot[i] < 0)
+			continue;
+		np = &names[slot[i]];
+		fprintf(cfile, "\t[%u] = { \"%s\", %d, %d, %s },\n",
+			i, np->name, np->builtin, np->toy, np->prog);
+	}
+	fputs("};\n"
+	      "\n"
+	      "const unsigned short dispatchdisp[DISPATCHBUCKETS] = {\n", cfile);
+	for (i = 0; i < nbuckets; i++)
+		fprintf(cfile, "\t%u,\n", disp[i]);
+	fputs("};\n", cfile);
+
+	fclose(hfile);
+	fclose(cfile);
+	return 0;
+}
@@ -89,12 +89,10 @@ struct output errout = {
 	.nextc = 0, .end = 0, .buf = 0, .bufsize = 0, .fd = 2, .flags = 0
 };
 struct output preverrout;
-#ifdef notyet
 struct output memout = {
 	.nextc = 0, .end = 0, .buf = 0, .bufsize = 0, .fd = MEM_OUT, .flags = 0
 };
 #endif
-#endif
 struct output *out1 = &output;
 struct output *out2 = &errout;
 
@@ -114,13 +112,8 @@ INIT {
 }
 
 RESET {
-#ifdef notyet
+#ifndef USE_GLIBC_STDIO
 	out1 = &output;
-	out2 = &errout;
-#ifdef USE_GLIBC_STDIO
-	if (memout.stream != NULL)
-		__closememout();
-#endif
 	if (memout.buf != NULL) {
 		ckfree(memout.buf);
 		memout.buf = NULL;
@@ -154,16 +147,13 @@ buffered:
 	if (!bufsize) {
 		;
 	} else if (dest->buf == NULL) {
-#ifdef notyet
 		if (dest->fd == MEM_OUT && len > bufsize) {
 			bufsize = len;
 		}
-#endif
 		offset = 0;
-#ifdef notyet
 		goto alloc;
 	} else if (dest->fd == MEM_OUT) {
-		offset = bufsize;
+		offset = dest->nextc - dest->buf;
 		if (bufsize >= len) {
 			bufsize <<= 1;
 		} else {
@@ -172,13 +162,14 @@ buffered:
 		if (bufsize < offset)
 			goto err;
 alloc:
-#endif
 		INTOFF;
 		dest->buf = ckrealloc(dest->buf, bufsize);
 		dest->bufsize = bufsize;
 		dest->end = dest->buf + bufsize;
 		dest->nextc = dest->buf + offset;
 		INTON;
+		if (dest->fd == MEM_OUT)
+			goto buffered;
 	} else {
 		flushout(dest);
 	}
@@ -188,9 +179,7 @@ alloc:
 		goto buffered;
 
 	if ((xwrite_(dest->fd, p, len))) {
-#ifdef notyet
 err:
-#endif
 		dest->flags |= OUTPUT_ERR;
 	}
 #endif
@@ -222,6 +211,35 @@ outcslow(int c, struct output *dest)
 	char buf = c;
 	outmem(&buf, 1, dest);
 }
+
+
+/*
+ * Send out1 to memory, for a command substitution evaluated in the
+ * shell itself.
+ */
+
+void
+pushmemout(void)
+{
+	memout.nextc = memout.end = memout.buf = NULL;
+	memout.bufsize = 128;
+	memout.flags = 0;
+	out1 = &memout;
+}
+
+
+/*
+ * Restore out1, handing over the ckmalloced buffer and its length.
+ */
+
+size_t
+popmemout(char **buf)
+{
+	out1 = &output;
+	*buf = memout.buf;
+	memout.buf = NULL;
+	return memout.nextc - *buf;
+}
 #endif
 
 
@@ -57,7 +57,7 @@ struct output {
 extern struct output output;
 extern struct output errout;
 extern struct output preverrout;
-#ifdef notyet
+#ifndef USE_GLIBC_STDIO
 extern struct output memout;
 #endif
 extern struct output *out1;
@@ -67,6 +67,8 @@ void outmem(const char *, size_t, struct output *);
 void outstr(const char *, struct output *);
 #ifndef USE_GLIBC_STDIO
 void outcslow(int, struct output *);
+void pushmemout(void);
+size_t popmemout(char **);
 #endif
 void flushall(void);
 void flushout(struct output *);
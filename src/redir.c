@@ -32,6 +32,7 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>	/* PIPE_BUF */
@@ -323,9 +324,9 @@ err:
 
 
 /*
- * Handle here documents.  Normally we fork off a process to write the
- * data to a pipe.  If the document is short, we can stuff the data in
- * the pipe without forking.
+ * Handle here documents.  If the document is short, we can stuff the
+ * data in a pipe.  Longer ones go in a memfd, and only if that is not
+ * available do we fork off a process to write the data to a pipe.
  */
 
 STATIC int
@@ -334,6 +335,7 @@ openhere(union node *redir)
 	char *p;
 	int pip[2];
 	size_t len = 0;
+	int fd;
 
 	p = redir->nhere.doc->narg.text;
 	if (redir->type == NXHERE) {
@@ -341,10 +343,16 @@ openhere(union node *redir)
 		p = stackblock();
 	}
 
+	len = strlen(p);
+	if (len > PIPESIZE && (fd = memfd_create("here", 0)) >= 0) {
+		if (!xwrite_(fd, p, len) && !lseek(fd, 0, SEEK_SET))
+			return fd;
+		close(fd);
+	}
+
 	if (pipe(pip) < 0)
 		sh_error("Pipe call failed");
 
-	len = strlen(p);
 	if (len <= PIPESIZE) {
 		xwrite_(pip[1], p, len);
 		goto out;
@@ -15,13 +15,46 @@
 #include "samu/parse.h"
 #include "samu/tool.h"
 #include "samu/util.h"
+#include "dispatch.h"
+
+void toy_exec(char *argv[]);
+int tcc_main(int argc, char *argv[]);
+int ar_main(int argc, char *argv[]);
 
 const char *argv0;
 
+static int
+toymain(int argc, char *argv[])
+{
+	toy_exec(argv);
+	return -1;
+}
+
+/* commands that shellexec would run without exec'ing another binary */
+static builtinfn *
+findbuiltin(const char *name)
+{
+	const struct dispatch *dp;
+
+	dp = finddispatch(name);
+	/* the shell's own builtins take precedence */
+	if (!dp || dp->builtin >= 0)
+		return NULL;
+	switch (dp->prog) {
+	case DISPATCH_TCC:
+		return tcc_main;
+	case DISPATCH_AR:
+		return ar_main;
+	}
+	if (dp->toy >= 0)
+		return toymain;
+	return NULL;
+}
+
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-C dir] [-f buildfile] [-j maxjobs] [-k maxfail] [-l maxload] [-n]\n", argv0);
+	fprintf(stderr, "usage: %s [-C dir] [-f buildfile] [-j maxjobs] [-k maxfail] [-l maxload] [-s statjobs] [-n]\n", argv0);
 	exit(2);
 }
 
@@ -47,6 +80,8 @@ debugflag(const char *flag)
 		buildopts.keepdepfile = true;
 	else if (strcmp(flag, "keeprsp") == 0)
 		buildopts.keeprsp = true;
+	else if (strcmp(flag, "nobuiltin") == 0)
+		buildopts.builtin = NULL;
 	else
 		fatal("unknown debug flag '%s'", flag);
 }
@@ -91,6 +126,35 @@ jobsflag(const char *flag)
 	buildopts.maxjobs = num > 0 ? num : -1;
 }
 
+static void
+statflag(const char *flag)
+{
+	long num;
+	char *end;
+
+	num = strtol(flag, &end, 10);
+	if (*end || num < 0)
+		fatal("invalid -s parameter");
+	buildopts.statjobs = num;
+}
+
+static void
+targets(int argc, char *argv[], void fn(struct node *))
+{
+	struct node *n;
+
+	if (!argc) {
+		defaultnodes(fn);
+		return;
+	}
+	for (; *argv; ++argv) {
+		n = nodeget(*argv, 0);
+		if (!n)
+			fatal("unknown target '%s'", *argv);
+		fn(n);
+	}
+}
+
 static void
 parseenvargs(char *env)
 {
@@ -121,6 +185,9 @@ parseenvargs(char *env)
 	case 'l':
 		loadflag(EARGF(usage()));
 		break;
+	case 's':
+		statflag(EARGF(usage()));
+		break;
 	default:
 		fatal("invalid option in SAMUFLAGS");
 	} ARGEND
@@ -149,6 +216,7 @@ samu_main(int argc, char *argv[])
 	int tries;
 
 	argv0 = progname(argv[0], "samu");
+	buildopts.builtin = findbuiltin;
 	parseenvargs(getenv("SAMUFLAGS"));
 	ARGBEGIN {
 	case '-':
@@ -186,6 +254,9 @@ samu_main(int argc, char *argv[])
 	case 'l':
 		loadflag(EARGF(usage()));
 		break;
+	case 's':
+		statflag(EARGF(usage()));
+		break;
 	case 'n':
 		buildopts.dryrun = true;
 		break;
@@ -263,16 +334,9 @@ retry:
 	}
 
 	/* finally, build any specified targets or the default targets */
-	if (argc) {
-		for (; *argv; ++argv) {
-			n = nodeget(*argv, 0);
-			if (!n)
-				fatal("unknown target '%s'", *argv);
-			buildadd(n);
-		}
-	} else {
-		defaultnodes(buildadd);
-	}
+	targets(argc, argv, statadd);
+	statall();
+	targets(argc, argv, buildadd);
 	build();
 	logclose();
 	depsclose();
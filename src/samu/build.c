@@ -2,12 +2,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
-#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
@@ -28,11 +30,20 @@ struct job {
 	bool failed;
 };
 
-struct buildoptions buildopts = {.maxfail = 1};
-static struct edge *work;
+struct buildoptions buildopts = {.maxfail = 1, .statjobs = 8};
+/* ready edges, as a heap with the heaviest edge first */
+static struct edge **work;
+static size_t worklen, workcap;
 static size_t nstarted, nfinished, ntotal;
 static bool consoleused;
 static struct timespec starttime;
+static int epfd = -1;
+/* files and edges found by statadd, and how far statall has got with them */
+static struct node **statq;
+static size_t statlen, statcap, statnext;
+static struct edge **statedges;
+static size_t nstatedges, statedgecap;
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
 
 void
 buildreset(void)
@@ -40,7 +51,7 @@ buildreset(void)
 	struct edge *e;
 
 	for (e = alledges; e; e = e->allnext)
-		e->flags &= ~FLAG_WORK;
+		e->flags &= ~(FLAG_WORK | FLAG_WEIGHT);
 }
 
 /* returns whether n1 is newer than n2, or false if n1 is NULL */
@@ -99,20 +110,225 @@ isdirty(struct node *n, struct node *newest, bool generator, bool restat)
 	return true;
 }
 
+static void
+workpush(struct edge *e)
+{
+	size_t i, j;
+
+	if (worklen == workcap) {
+		workcap = workcap ? workcap * 2 : 64;
+		work = xreallocarray(work, workcap, sizeof(work[0]));
+	}
+	for (i = worklen++; i > 0; i = j) {
+		j = (i - 1) / 2;
+		if (work[j]->weight >= e->weight)
+			break;
+		work[i] = work[j];
+	}
+	work[i] = e;
+}
+
+static struct edge *
+workpop(void)
+{
+	struct edge *e, *last;
+	size_t i, j;
+
+	e = work[0];
+	last = work[--worklen];
+	for (i = 0; (j = 2 * i + 1) < worklen; i = j) {
+		if (j + 1 < worklen && work[j + 1]->weight > work[j]->weight)
+			++j;
+		if (last->weight >= work[j]->weight)
+			break;
+		work[i] = work[j];
+	}
+	work[i] = last;
+
+	return e;
+}
+
 /* add an edge to the work queue */
 static void
 queue(struct edge *e)
 {
-	struct edge **front = &work;
-
 	if (e->pool && e->rule != &phonyrule) {
-		if (e->pool->numjobs == e->pool->maxjobs)
-			front = &e->pool->work;
-		else
-			++e->pool->numjobs;
+		if (e->pool->numjobs == e->pool->maxjobs) {
+			e->worknext = e->pool->work;
+			e->pool->work = e;
+			return;
+		}
+		++e->pool->numjobs;
+	}
+	workpush(e);
+}
+
+/* the length of the longest chain of dirty edges starting at e, using
+ * durations from the build log (or the average for edges not in the log) */
+static int64_t
+edgeweight(struct edge *e, int64_t avg)
+{
+	struct node *n;
+	struct edge *use;
+	size_t i, j;
+	int64_t w, max;
+
+	if (e->flags & FLAG_WEIGHT)
+		return e->weight;
+	e->flags |= FLAG_WEIGHT;
+	max = 0;
+	for (i = 0; i < e->nout; ++i) {
+		n = e->out[i];
+		for (j = 0; j < n->nuse; ++j) {
+			use = n->use[j];
+			if (use->flags & FLAG_WORK && (w = edgeweight(use, avg)) > max)
+				max = w;
+		}
+	}
+	if (e->rule == &phonyrule || !(e->flags & FLAG_DIRTY))
+		w = 0;
+	else if (e->logend > e->logstart)
+		w = e->logend - e->logstart;
+	else
+		w = avg;
+	e->weight = max + w;
+
+	return e->weight;
+}
+
+/* orders the work queue by critical path, now that all targets are added */
+static void
+weighwork(void)
+{
+	struct edge *e;
+	int64_t total = 0, count = 0;
+	size_t i, n;
+
+	for (e = alledges; e; e = e->allnext) {
+		if (e->flags & FLAG_WORK && e->logend > e->logstart) {
+			total += e->logend - e->logstart;
+			++count;
+		}
+	}
+	for (e = alledges; e; e = e->allnext) {
+		if (e->flags & FLAG_WORK)
+			edgeweight(e, count ? total / count : 1);
+	}
+	n = worklen;
+	worklen = 0;
+	for (i = 0; i < n; ++i)
+		workpush(work[i]);
+}
+
+/* milliseconds since the start of the build */
+static int64_t
+buildtime(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+		warn("clock_gettime:");
+		return 0;
+	}
+
+	return (now.tv_sec - starttime.tv_sec) * 1000 + (now.tv_nsec - starttime.tv_nsec) / 1000000;
+}
+
+static void
+statqueue(struct node *n)
+{
+	if (n->mtime != MTIME_UNKNOWN)
+		return;
+	n->mtime = MTIME_QUEUED;
+	if (statlen == statcap) {
+		statcap = statcap ? statcap * 2 : 1024;
+		statq = xreallocarray(statq, statcap, sizeof(statq[0]));
+	}
+	statq[statlen++] = n;
+}
+
+void
+statadd(struct node *n)
+{
+	struct edge *e;
+	size_t i;
+
+	if (buildopts.statjobs < 2)
+		return;
+	statqueue(n);
+	e = n->gen;
+	if (!e || e->flags & FLAG_STAT)
+		return;
+	e->flags |= FLAG_STAT;
+	if (nstatedges == statedgecap) {
+		statedgecap = statedgecap ? statedgecap * 2 : 1024;
+		statedges = xreallocarray(statedges, statedgecap, sizeof(statedges[0]));
+	}
+	statedges[nstatedges++] = e;
+	for (i = 0; i < e->nout; ++i)
+		statqueue(e->out[i]);
+	for (i = 0; i < e->nin; ++i)
+		statadd(e->in[i]);
+}
+
+static void *
+statwork(void *arg)
+{
+	size_t i, end;
+
+	for (;;) {
+		pthread_mutex_lock(&statlock);
+		i = statnext;
+		end = statlen - i > 64 ? i + 64 : statlen;
+		statnext = end;
+		pthread_mutex_unlock(&statlock);
+		if (i == end)
+			return NULL;
+		for (; i < end; ++i)
+			nodestat(statq[i]);
+	}
+}
+
+void
+statall(void)
+{
+	pthread_t *threads;
+	size_t i, j, nthreads, edgesdone, end;
+	struct edge *e;
+
+	if (buildopts.statjobs < 2)
+		return;
+	threads = xreallocarray(NULL, buildopts.statjobs, sizeof(threads[0]));
+	edgesdone = 0;
+	while (statnext < statlen || edgesdone < nstatedges) {
+		/* only the edges queued so far have had their outputs stat */
+		end = nstatedges;
+		nthreads = (statlen - statnext) / 256 + 1;
+		if (nthreads > buildopts.statjobs)
+			nthreads = buildopts.statjobs;
+		for (i = 1; i < nthreads; ++i) {
+			if (pthread_create(&threads[i], NULL, statwork, NULL) != 0)
+				break;
+		}
+		statwork(NULL);
+		for (j = 1; j < i; ++j)
+			pthread_join(threads[j], NULL);
+		/* depsload needs the output mtimes, and may add inputs we
+		 * haven't seen yet */
+		for (; edgesdone < end; ++edgesdone) {
+			e = statedges[edgesdone];
+			depsload(e);
+			for (i = 0; i < e->nin; ++i)
+				statadd(e->in[i]);
+		}
 	}
-	e->worknext = *front;
-	*front = e;
+	free(threads);
+	free(statq);
+	free(statedges);
+	statq = NULL;
+	statedges = NULL;
+	statlen = statcap = statnext = 0;
+	nstatedges = statedgecap = 0;
 }
 
 void
@@ -273,6 +489,71 @@ printstatus(struct edge *e, struct string *cmd)
 	puts(description->s);
 }
 
+/* splits a command into words if the shell would do nothing else with it */
+static char **
+splitcmd(const char *cmd)
+{
+	char **argv, *s;
+	size_t len, n, i;
+
+	if (cmd[strcspn(cmd, "|&;<>()$`\\\"'*?[#~{}!\n")])
+		return NULL;
+	cmd += strspn(cmd, " \t");
+	len = strcspn(cmd, " \t");
+	/* variable assignment */
+	if (len == 0 || memchr(cmd, '=', len))
+		return NULL;
+	for (n = 0, s = (char *)cmd; *s; ++n) {
+		s += strcspn(s, " \t");
+		s += strspn(s, " \t");
+	}
+	len = strlen(cmd);
+	argv = xmalloc((n + 1) * sizeof(*argv) + len + 1);
+	s = memcpy(argv + n + 1, cmd, len + 1);
+	for (i = 0; i < n; ++i) {
+		argv[i] = s;
+		s += strcspn(s, " \t");
+		if (*s)
+			*s++ = '\0';
+		s += strspn(s, " \t");
+	}
+	argv[n] = NULL;
+
+	return argv;
+}
+
+/* runs a builtin command in a forked child, with the same file descriptors
+ * posix_spawn would have set up */
+static int
+jobfork(struct job *j, struct edge *e, builtinfn *fn, char **argv, int fd[2])
+{
+	int argc, null;
+	char *shargv[] = {"/bin/sh", "-c", j->cmd->s, NULL};
+
+	/* the child may exit through stdio, so don't let it inherit our
+	 * buffered output (including .ninja_log and .ninja_deps) */
+	fflush(NULL);
+	j->pid = fork();
+	if (j->pid != 0)
+		return j->pid < 0 ? -1 : 0;
+	close(fd[0]);
+	if (e->pool != &consolepool) {
+		null = open("/dev/null", O_RDONLY);
+		if (null < 0 || dup2(null, 0) < 0 || dup2(fd[1], 1) < 0 || dup2(fd[1], 2) < 0)
+			_exit(127);
+		if (null != 0)
+			close(null);
+		close(fd[1]);
+	}
+	for (argc = 0; argv[argc]; ++argc)
+		;
+	argc = fn(argc, argv);
+	if (argc >= 0)
+		exit(argc);
+	execv(shargv[0], shargv);
+	_exit(127);
+}
+
 static int
 jobstart(struct job *j, struct edge *e)
 {
@@ -282,7 +563,8 @@ jobstart(struct job *j, struct edge *e)
 	struct string *rspfile, *content;
 	int fd[2];
 	posix_spawn_file_actions_t actions;
-	char *argv[] = {"/bin/sh", "-c", NULL, NULL};
+	char *argv[] = {"/bin/sh", "-c", NULL, NULL}, **args;
+	builtinfn *fn;
 
 	++nstarted;
 	for (i = 0; i < e->nout; ++i) {
@@ -311,6 +593,18 @@ jobstart(struct job *j, struct edge *e)
 	if (!consoleused)
 		printstatus(e, j->cmd);
 
+	if (buildopts.builtin && (args = splitcmd(j->cmd->s))) {
+		fn = buildopts.builtin(args[0]);
+		if (fn && jobfork(j, e, fn, args, fd) < 0)
+			warn("fork:");
+		free(args);
+		if (fn) {
+			if (j->pid < 0)
+				goto err2;
+			goto started;
+		}
+	}
+
 	if ((errno = posix_spawn_file_actions_init(&actions))) {
 		warn("posix_spawn_file_actions_init:");
 		goto err2;
@@ -342,7 +636,9 @@ jobstart(struct job *j, struct edge *e)
 		goto err3;
 	}
 	posix_spawn_file_actions_destroy(&actions);
+started:
 	close(fd[1]);
+	e->logstart = buildtime();
 	j->failed = false;
 	if (e->pool == &consolepool)
 		consoleused = true;
@@ -466,6 +762,9 @@ jobdone(struct job *j)
 		warn("job status unknown: %s", j->cmd->s);
 		j->failed = true;
 	}
+	/* forked builtin jobs may still hold the pipe open, so it would stay
+	 * in the epoll set after we close it */
+	epoll_ctl(epfd, EPOLL_CTL_DEL, j->fd, NULL);
 	close(j->fd);
 	if (j->buf.len && (!consoleused || j->failed))
 		fwrite(j->buf.data, 1, j->buf.len, stdout);
@@ -480,12 +779,12 @@ jobdone(struct job *j)
 		if (p->work) {
 			new = p->work;
 			p->work = p->work->worknext;
-			new->worknext = work;
-			work = new;
+			workpush(new);
 		} else {
 			--p->numjobs;
 		}
 	}
+	e->logend = buildtime();
 	if (!j->failed)
 		edgedone(e);
 }
@@ -548,9 +847,10 @@ void
 build(void)
 {
 	struct job *jobs = NULL;
-	struct pollfd *fds = NULL;
+	struct epoll_event *events = NULL, ev;
 	size_t i, next = 0, jobslen = 0, maxjobs = buildopts.maxjobs, numjobs = 0, numfail = 0;
 	struct edge *e;
+	int k, nready;
 
 	if (ntotal == 0) {
 		warn("nothing to do");
@@ -559,6 +859,9 @@ build(void)
 
 	clock_gettime(CLOCK_MONOTONIC, &starttime);
 	formatstatus(NULL, 0);
+	weighwork();
+	if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		fatal("epoll_create1:");
 
 	nstarted = 0;
 	for (;;) {
@@ -566,9 +869,8 @@ build(void)
 		if (buildopts.maxload)
 			maxjobs = queryload() > buildopts.maxload ? 1 : buildopts.maxjobs;
 		/* start ready edges */
-		while (work && numjobs < maxjobs && numfail < buildopts.maxfail) {
-			e = work;
-			work = work->worknext;
+		while (worklen && numjobs < maxjobs && numfail < buildopts.maxfail) {
+			e = workpop();
 			if (e->rule != &phonyrule && buildopts.dryrun) {
 				++nstarted;
 				printstatus(e, edgevar(e, "command", true));
@@ -584,38 +886,39 @@ build(void)
 				if (jobslen > buildopts.maxjobs)
 					jobslen = buildopts.maxjobs;
 				jobs = xreallocarray(jobs, jobslen, sizeof(jobs[0]));
-				fds = xreallocarray(fds, jobslen, sizeof(fds[0]));
+				events = xreallocarray(events, jobslen, sizeof(events[0]));
 				for (i = next; i < jobslen; ++i) {
 					jobs[i].buf.data = NULL;
 					jobs[i].buf.len = 0;
 					jobs[i].buf.cap = 0;
 					jobs[i].next = i + 1;
-					fds[i].fd = -1;
-					fds[i].events = POLLIN;
 				}
 			}
-			fds[next].fd = jobstart(&jobs[next], e);
-			if (fds[next].fd < 0) {
+			if (jobstart(&jobs[next], e) < 0) {
 				warn("job failed to start");
 				++numfail;
-			} else {
-				next = jobs[next].next;
-				++numjobs;
+				continue;
 			}
+			ev.events = EPOLLIN;
+			ev.data.u64 = next;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, jobs[next].fd, &ev) < 0)
+				fatal("epoll_ctl:");
+			next = jobs[next].next;
+			++numjobs;
 		}
 		if (numjobs == 0)
 			break;
-		while (poll(fds, jobslen, 5000) < 0) {
+		while ((nready = epoll_wait(epfd, events, jobslen, 5000)) < 0) {
 			if (errno == EINTR)
 				continue;
-			fatal("poll:");
+			fatal("epoll_wait:");
 		}
-		for (i = 0; i < jobslen; ++i) {
-			if (!fds[i].revents || jobwork(&jobs[i]))
+		for (k = 0; k < nready; ++k) {
+			i = events[k].data.u64;
+			if (jobwork(&jobs[i]))
 				continue;
 			--numjobs;
 			jobs[i].next = next;
-			fds[i].fd = -1;
 			next = i;
 			if (jobs[i].failed)
 				++numfail;
@@ -624,7 +927,7 @@ build(void)
 	for (i = 0; i < jobslen; ++i)
 		free(jobs[i].buf.data);
 	free(jobs);
-	free(fds);
+	free(events);
 	if (numfail > 0) {
 		if (numfail < buildopts.maxfail)
 			fatal("cannot make progress due to previous errors");
@@ -1,16 +1,26 @@
 struct node;
 
+/* entry point of a command that can run without /bin/sh; returns the exit
+ * status, or -1 if it couldn't run the command after all */
+typedef int builtinfn(int, char **);
+
 struct buildoptions {
-	size_t maxjobs, maxfail;
+	size_t maxjobs, maxfail, statjobs;
 	_Bool verbose, explain, keepdepfile, keeprsp, dryrun;
 	const char *statusfmt;
 	double maxload;
+	/* if set, looks up commands to run in a forked child without a shell */
+	builtinfn *(*builtin)(const char *);
 };
 
 extern struct buildoptions buildopts;
 
 /* reset state, so a new build can be executed */
 void buildreset(void);
+/* queue the files needed to build a target for statall */
+void statadd(struct node *);
+/* stat the queued files, and load their dependencies, with statjobs threads */
+void statall(void);
 /* schedule a particular target to be built */
 void buildadd(struct node *);
 /* execute rules to build the scheduled targets */
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -5,6 +6,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "build.h"
 #include "deps.h"
 #include "env.h"
@@ -47,8 +50,15 @@ struct nodearray {
 	size_t len;
 };
 
+/* the log is mapped into memory, and records are only turned into nodes
+ * when an edge needs them */
 struct entry {
 	struct node *node;
+	/* path of the node record, until node is resolved */
+	const char *path;
+	size_t pathlen;
+	/* IDs from the latest dependency record, until deps is resolved */
+	const uint32_t *ids;
 	struct nodearray deps;
 	int64_t mtime;
 };
@@ -60,6 +70,10 @@ static const uint32_t depsver = 4;
 static FILE *depsfile;
 static struct entry *entries;
 static size_t entrieslen, entriescap;
+static void *depsmap;
+static size_t depsmaplen;
+/* whether any entries may still have unresolved paths or IDs */
+static bool unresolved;
 
 static void
 depswrite(const void *p, size_t n, size_t m)
@@ -68,16 +82,97 @@ depswrite(const void *p, size_t n, size_t m)
 		fatal("deps log write:");
 }
 
+static struct node *
+entrynode(struct entry *entry)
+{
+	struct string *path;
+
+	if (!entry->node) {
+		path = mkstr(entry->pathlen);
+		memcpy(path->s, entry->path, entry->pathlen);
+		path->s[entry->pathlen] = '\0';
+		entry->node = mknode(path);
+		entry->node->id = entry - entries;
+	}
+
+	return entry->node;
+}
+
+static struct nodearray *
+entrydeps(struct entry *entry)
+{
+	size_t i;
+
+	if (entry->ids) {
+		entry->deps.node = xreallocarray(NULL, entry->deps.len, sizeof(entry->deps.node[0]));
+		for (i = 0; i < entry->deps.len; ++i)
+			entry->deps.node[i] = entrynode(&entries[entry->ids[i]]);
+		entry->ids = NULL;
+	}
+
+	return &entry->deps;
+}
+
+/* look up the outputs of dependency records, dropping records for nodes
+ * that are no longer built by an edge with deps */
+static void
+depsoutputs(void)
+{
+	struct entry *entry;
+	struct node *n;
+	struct edge *e;
+	size_t i;
+
+	for (i = 0; i < entrieslen; ++i) {
+		entry = &entries[i];
+		if (!entry->ids)
+			continue;
+		n = entry->node ? entry->node : nodeget(entry->path, entry->pathlen);
+		e = n ? n->gen : NULL;
+		if (!e || !edgevar(e, "deps", true)) {
+			entry->ids = NULL;
+			entry->deps.len = 0;
+			continue;
+		}
+		entry->node = n;
+		n->id = i;
+	}
+}
+
+/* create nodes for every record, so that new IDs are only assigned to
+ * paths that aren't in the log yet */
+static void
+depsresolve(void)
+{
+	size_t i;
+
+	if (!unresolved)
+		return;
+	unresolved = false;
+	for (i = 0; i < entrieslen; ++i) {
+		entrynode(&entries[i]);
+		entrydeps(&entries[i]);
+	}
+}
+
 static bool
 recordid(struct node *n)
 {
 	uint32_t sz, chk;
 
+	if (n->id != -1)
+		return false;
+	depsresolve();
 	if (n->id != -1)
 		return false;
 	if (entrieslen == INT32_MAX)
 		fatal("too many nodes");
-	n->id = entrieslen++;
+	if (entrieslen >= entriescap) {
+		entriescap = entriescap ? entriescap * 2 : 1024;
+		entries = xreallocarray(entries, entriescap, sizeof(entries[0]));
+	}
+	n->id = entrieslen;
+	entries[entrieslen++] = (struct entry){.node = n};
 	sz = (n->path->n + 7) & ~3;
 	if (sz + 4 >= MAX_RECORD_SIZE)
 		fatal("ID record too large");
@@ -114,22 +209,24 @@ void
 depsinit(const char *builddir)
 {
 	char *depspath = (char *)depsname, *depstmppath = (char *)depstmpname;
-	uint32_t *buf, cap, ver, sz, id;
+	const char *pos, *end;
+	const uint32_t *buf;
+	uint32_t ver, sz, id;
 	size_t len, i, j, nrecord;
 	bool isdep;
-	struct string *path;
-	struct node *n;
-	struct edge *e;
 	struct entry *entry, *oldentries;
+	struct stat st;
 
 	/* XXX: when ninja hits a bad record, it truncates the log to the last
 	 * good record. perhaps we should do the same. */
 
 	if (depsfile)
 		fclose(depsfile);
+	if (depsmap)
+		munmap(depsmap, depsmaplen);
+	depsmap = NULL;
 	entrieslen = 0;
-	cap = BUFSIZ;
-	buf = xmalloc(cap);
+	unresolved = false;
 	if (builddir)
 		xasprintf(&depspath, "%s/%s", builddir, depsname);
 	depsfile = fopen(depspath, "r+");
@@ -138,71 +235,75 @@ depsinit(const char *builddir)
 			fatal("open %s:", depspath);
 		goto rewrite;
 	}
-	if (!fgets((char *)buf, sizeof(depsheader), depsfile))
+	if (fstat(fileno(depsfile), &st) < 0)
+		fatal("stat %s:", depspath);
+	if (st.st_size == 0)
 		goto rewrite;
-	if (strcmp((char *)buf, depsheader) != 0) {
+	depsmaplen = st.st_size;
+	depsmap = mmap(NULL, depsmaplen, PROT_READ, MAP_PRIVATE, fileno(depsfile), 0);
+	if (depsmap == MAP_FAILED) {
+		depsmap = NULL;
+		fatal("mmap %s:", depspath);
+	}
+	pos = depsmap;
+	end = pos + depsmaplen;
+	len = sizeof(depsheader) - 1;
+	if ((size_t)(end - pos) < len || memcmp(pos, depsheader, len) != 0) {
 		warn("invalid deps log header");
 		goto rewrite;
 	}
-	if (fread(&ver, sizeof(ver), 1, depsfile) != 1) {
-		warn(ferror(depsfile) ? "deps log read:" : "deps log truncated");
+	pos += len;
+	if (end - pos < 4) {
+		warn("deps log truncated");
 		goto rewrite;
 	}
+	memcpy(&ver, pos, 4);
+	pos += 4;
 	if (ver != depsver) {
 		warn("unknown deps log version");
 		goto rewrite;
 	}
-	for (nrecord = 0;; ++nrecord) {
-		if (fread(&sz, sizeof(sz), 1, depsfile) != 1)
-			break;
+	/* records are 4-byte aligned, and so is the header */
+	for (nrecord = 0; end - pos >= 4; ++nrecord) {
+		memcpy(&sz, pos, 4);
+		pos += 4;
 		isdep = sz & 0x80000000;
 		sz &= 0x7fffffff;
 		if (sz > MAX_RECORD_SIZE) {
 			warn("deps record too large");
 			goto rewrite;
 		}
-		if (sz > cap) {
-			do cap *= 2;
-			while (sz > cap);
-			free(buf);
-			buf = xmalloc(cap);
-		}
-		if (fread(buf, sz, 1, depsfile) != 1) {
-			warn(ferror(depsfile) ? "deps log read:" : "deps log truncated");
+		if (sz > (size_t)(end - pos)) {
+			warn("deps log truncated");
 			goto rewrite;
 		}
 		if (sz % 4) {
 			warn("invalid size, must be multiple of 4: %" PRIu32, sz);
 			goto rewrite;
 		}
+		buf = (const uint32_t *)pos;
+		pos += sz;
 		if (isdep) {
 			if (sz < 12) {
 				warn("invalid size, must be at least 12: %" PRIu32, sz);
 				goto rewrite;
 			}
-			sz -= 12;
+			sz = (sz - 12) / 4;
 			id = buf[0];
 			if (id >= entrieslen) {
 				warn("invalid node ID: %" PRIu32, id);
 				goto rewrite;
 			}
-			entry = &entries[id];
-			entry->mtime = (int64_t)buf[2] << 32 | buf[1];
-			e = entry->node->gen;
-			if (!e || !edgevar(e, "deps", true))
-				continue;
-			sz /= 4;
-			free(entry->deps.node);
-			entry->deps.len = sz;
-			entry->deps.node = xreallocarray(NULL, sz, sizeof(n));
 			for (i = 0; i < sz; ++i) {
-				id = buf[3 + i];
-				if (id >= entrieslen) {
-					warn("invalid node ID: %" PRIu32, id);
+				if (buf[3 + i] >= entrieslen) {
+					warn("invalid node ID: %" PRIu32, buf[3 + i]);
 					goto rewrite;
 				}
-				entry->deps.node[i] = entries[id].node;
 			}
+			entry = &entries[id];
+			entry->mtime = (int64_t)buf[2] << 32 | buf[1];
+			entry->ids = buf + 3;
+			entry->deps.len = sz;
 		} else {
 			if (sz <= 4) {
 				warn("invalid size, must be greater than 4: %" PRIu32, sz);
@@ -217,34 +318,31 @@ depsinit(const char *builddir)
 				goto rewrite;
 			}
 			len = sz - 4;
-			while (((char *)buf)[len - 1] == '\0')
+			while (((const char *)buf)[len - 1] == '\0')
 				--len;
-			path = mkstr(len);
-			memcpy(path->s, buf, len);
-			path->s[len] = '\0';
-
-			n = mknode(path);
 			if (entrieslen >= entriescap) {
 				entriescap = entriescap ? entriescap * 2 : 1024;
 				entries = xreallocarray(entries, entriescap, sizeof(entries[0]));
 			}
-			n->id = entrieslen;
-			entries[entrieslen++] = (struct entry){.node = n};
+			entries[entrieslen++] = (struct entry){.path = (const char *)buf, .pathlen = len};
 		}
 	}
-	if (ferror(depsfile)) {
-		warn("deps log read:");
-		goto rewrite;
-	}
+	/* only outputs with a dependency record are looked up now; their
+	 * dependencies wait until depsload needs them */
+	unresolved = true;
+	depsoutputs();
+	if (fseek(depsfile, 0, SEEK_END) < 0)
+		fatal("deps log seek:");
 	if (nrecord <= 1000 || nrecord < 3 * entrieslen) {
 		if (builddir)
 			free(depspath);
-		free(buf);
 		return;
 	}
 
 rewrite:
-	free(buf);
+	unresolved = true;
+	depsoutputs();
+	depsresolve();
 	if (depsfile)
 		fclose(depsfile);
 	if (builddir)
@@ -430,7 +528,7 @@ depsload(struct edge *e)
 	deptype = edgevar(e, "deps", true);
 	if (deptype) {
 		if (n->id != -1 && n->mtime <= entries[n->id].mtime)
-			deps = &entries[n->id].deps;
+			deps = entrydeps(&entries[n->id]);
 		else if (buildopts.explain)
 			warn("explain %s: missing or outdated record in .ninja_deps", n->path->s);
 	} else {
@@ -483,6 +581,7 @@ depsrecord(struct edge *e)
 		update = true;
 	} else {
 		entry = &entries[out->id];
+		entrydeps(entry);
 		if (entry->mtime != out->mtime || entry->deps.len != deps->len)
 			update = true;
 		for (i = 0; i < deps->len && !update; ++i) {
@@ -165,6 +165,8 @@ mkedge(struct environment *parent)
 	e->in = NULL;
 	e->nin = 0;
 	e->flags = 0;
+	e->logstart = 0;
+	e->logend = 0;
 	e->allnext = alledges;
 	alledges = e;
 
@@ -6,6 +6,8 @@ enum {
 	MTIME_UNKNOWN = -1,
 	/* the file does not exist */
 	MTIME_MISSING = -2,
+	/* queued for the stat pre-pass, see statall */
+	MTIME_QUEUED = -3,
 };
 
 struct node {
@@ -52,14 +54,22 @@ struct edge {
 	/* how many inputs need to be pruned before all outputs can be pruned */
 	size_t nprune;
 
+	/* start and end time in milliseconds of the last run, from the build log */
+	int64_t logstart, logend;
+	/* estimated time in milliseconds to finish this edge and everything
+	 * that depends on it, used to start long chains first */
+	int64_t weight;
+
 	enum {
 		FLAG_WORK      = 1 << 0,  /* scheduled for build */
 		FLAG_HASH      = 1 << 1,  /* calculated the command hash */
+		FLAG_WEIGHT    = 1 << 2,  /* calculated the critical path weight */
 		FLAG_DIRTY_IN  = 1 << 3,  /* dirty input */
 		FLAG_DIRTY_OUT = 1 << 4,  /* missing or outdated output */
 		FLAG_DIRTY     = FLAG_DIRTY_IN | FLAG_DIRTY_OUT,
 		FLAG_CYCLE     = 1 << 5,  /* used for cycle detection */
 		FLAG_DEPS      = 1 << 6,  /* dependencies loaded */
+		FLAG_STAT      = 1 << 7,  /* visited by the stat pre-pass */
 	} flags;
 
 	/* used to coordinate ready work in build() */
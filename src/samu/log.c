@@ -37,7 +37,7 @@ loginit(const char *builddir)
 	size_t nline, nentry, i;
 	struct edge *e;
 	struct node *n;
-	int64_t mtime;
+	int64_t start, end, mtime;
 	struct buffer buf = {0};
 
 	nline = 0;
@@ -74,10 +74,14 @@ loginit(const char *builddir)
 		++nline;
 		p = buf.data;
 		buf.len = 0;
-		if (!nextfield(&p))  /* start time */
+		s = nextfield(&p);  /* start time */
+		if (!s)
 			continue;
-		if (!nextfield(&p))  /* end time */
+		start = strtoll(s, NULL, 10);
+		s = nextfield(&p);  /* end time */
+		if (!s)
 			continue;
+		end = strtoll(s, NULL, 10);
 		s = nextfield(&p);  /* mtime (used for restat) */
 		if (!s)
 			continue;
@@ -95,6 +99,8 @@ loginit(const char *builddir)
 		if (n->logmtime == MTIME_MISSING)
 			++nentry;
 		n->logmtime = mtime;
+		n->gen->logstart = start;
+		n->gen->logend = end;
 		s = nextfield(&p);  /* command hash */
 		if (!s)
 			continue;
@@ -158,5 +164,5 @@ logclose(void)
 void
 logrecord(struct node *n)
 {
-	fprintf(logfile, "0\t0\t%" PRId64 "\t%s\t%" PRIx64 "\n", n->logmtime, n->path->s, n->hash);
+	fprintf(logfile, "%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%s\t%" PRIx64 "\n", n->gen->logstart, n->gen->logend, n->logmtime, n->path->s, n->hash);
 }
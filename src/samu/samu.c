@@ -20,7 +20,7 @@ const char *argv0;
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-C dir] [-f buildfile] [-j maxjobs] [-k maxfail] [-l maxload] [-n]\n", argv0);
+	fprintf(stderr, "usage: %s [-C dir] [-f buildfile] [-j maxjobs] [-k maxfail] [-l maxload] [-s statjobs] [-n]\n", argv0);
 	exit(2);
 }
 
@@ -90,6 +90,35 @@ jobsflag(const char *flag)
 	buildopts.maxjobs = num > 0 ? num : -1;
 }
 
+static void
+statflag(const char *flag)
+{
+	long num;
+	char *end;
+
+	num = strtol(flag, &end, 10);
+	if (*end || num < 0)
+		fatal("invalid -s parameter");
+	buildopts.statjobs = num;
+}
+
+static void
+targets(int argc, char *argv[], void fn(struct node *))
+{
+	struct node *n;
+
+	if (!argc) {
+		defaultnodes(fn);
+		return;
+	}
+	for (; *argv; ++argv) {
+		n = nodeget(*argv, 0);
+		if (!n)
+			fatal("unknown target '%s'", *argv);
+		fn(n);
+	}
+}
+
 static void
 parseenvargs(char *env)
 {
@@ -120,6 +149,9 @@ parseenvargs(char *env)
 	case 'l':
 		loadflag(EARGF(usage()));
 		break;
+	case 's':
+		statflag(EARGF(usage()));
+		break;
 	default:
 		fatal("invalid option in SAMUFLAGS");
 	} ARGEND
@@ -185,6 +217,9 @@ main(int argc, char *argv[])
 	case 'l':
 		loadflag(EARGF(usage()));
 		break;
+	case 's':
+		statflag(EARGF(usage()));
+		break;
 	case 'n':
 		buildopts.dryrun = true;
 		break;
@@ -262,16 +297,9 @@ retry:
 	}
 
 	/* finally, build any specified targets or the default targets */
-	if (argc) {
-		for (; *argv; ++argv) {
-			n = nodeget(*argv, 0);
-			if (!n)
-				fatal("unknown target '%s'", *argv);
-			buildadd(n);
-		}
-	} else {
-		defaultnodes(buildadd);
-	}
+	targets(argc, argv, statadd);
+	statall();
+	targets(argc, argv, buildadd);
 	build();
 	logclose();
 	depsclose();
@@ -23,11 +23,18 @@
  */
 
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
 #include "../lib/tcc/tcc.h"
 #include "../lib/tcc/tcctools.c"
 
+#include "libtcc1a.h"
+
 int ld_add_file(TCCState *s1, const char filename[]);
+long long gunzip_mem(char *inbuf, int inlen, char *outbuf, int outlen);
 
 /*
 Tiny C Compiler - Copyright (C) 2001-2006 Fabrice Bellard
@@ -35,6 +42,7 @@ Usage: tcc [options...] [-o outfile] [-c] infile(s)...
        tcc [options...] -run infile (or --) [arguments...]
 General options:
   -c           compile only - generate an object file
+  -j N         compile up to N files at once with -c (default: CPU count)
   -o outfile   set output filename
   -run         run compiled source
   -fflag       set or reset (with 'no-' prefix) 'flag' (see tcc -hh)
@@ -45,7 +53,9 @@ General options:
   -v --version show version
   -vv          show search paths or loaded files
   -h -hh       show this, show more help
-  -bench       show compilation statistics
+  -bench       show compilation and link statistics
+  -cache-stats show -run compile cache statistics
+  -cache-clean remove all -run compile cache entries
   -            use stdin pipe as infile
   @listfile    read arguments from listfile
 Preprocessor options:
@@ -201,15 +211,436 @@ int tcc_add_library_err_stubs(TCCState *s1, const char *libname) {
     return tcc_add_library_err(s1, libname);
 }
 
+/* ------------------------------------------------------------- */
+/* compile cache for -run
+ *
+ * The linked executable of a -run compile is stored under $TCC_CACHE_DIR
+ * (default $HOME/.cache/tcc, empty to disable) as <key>, together with a
+ * <key>.deps manifest listing every source and header that was read.
+ * The key covers the compiler binary, libc.a, the options and the
+ * contents of the source files; the manifest is checked before the
+ * cached executable is exec'd directly. */
+
+typedef unsigned long long cache_hash;
+
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+static char cache_entry[1024];
+static int cache_dir_len;
+
+static cache_hash cache_hash_mem(cache_hash h, const void *p, size_t len)
+{
+    const unsigned char *c = p;
+    while (len--)
+        h = (h ^ *c++) * 0x100000001b3ULL;
+    return h;
+}
+
+static cache_hash cache_hash_str(cache_hash h, const char *str)
+{
+    return cache_hash_mem(h, str, strlen(str) + 1);
+}
+
+static cache_hash cache_hash_stat(cache_hash h, const char *filename)
+{
+    struct stat st;
+    long long v[2] = { 0, 0 };
+    if (stat(filename, &st) == 0)
+        v[0] = st.st_size, v[1] = st.st_mtime;
+    return cache_hash_mem(cache_hash_str(h, filename), v, sizeof v);
+}
+
+static unsigned long long cache_mtime(struct stat *st)
+{
+    return st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static int cache_hash_file(const char *filename, struct stat *st, cache_hash *h)
+{
+    void *p;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, st) || !S_ISREG(st->st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if (st->st_size) {
+        p = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        *h = cache_hash_mem(*h, p, st->st_size);
+        munmap(p, st->st_size);
+    }
+    close(fd);
+    return 0;
+}
+
+static int cache_get_dir(char *buf, int size)
+{
+    const char *dir = getenv("TCC_CACHE_DIR"), *home;
+    if (dir) {
+        if (!*dir)
+            return -1;
+        return snprintf(buf, size, "%s", dir);
+    }
+    home = getenv("HOME");
+    if (!home || !*home)
+        return -1;
+    return snprintf(buf, size, "%s/.cache/tcc", home);
+}
+
+static int cache_mkdirs(char *path)
+{
+    char *p = path;
+    while ((p = strchr(p + 1, '/'))) {
+        *p = 0;
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    return mkdir(path, 0755) && errno != EEXIST ? -1 : 0;
+}
+
+/* bump the hit or miss counter, and report both under -bench */
+static void cache_count(TCCState *s, int hit)
+{
+    unsigned long long count[2] = { 0, 0 };
+    char path[sizeof cache_entry], buf[64];
+    int fd, len;
+
+    snprintf(path, sizeof path, "%.*s/stats", cache_dir_len, cache_entry);
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX) == 0) {
+        len = pread(fd, buf, sizeof buf - 1, 0);
+        buf[len > 0 ? len : 0] = 0;
+        sscanf(buf, "%llu %llu", &count[0], &count[1]);
+        count[!hit]++;
+        len = snprintf(buf, sizeof buf, "%llu %llu\n", count[0], count[1]);
+        pwrite(fd, buf, len, 0);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (s->do_bench)
+        fprintf(stderr, "# cache %s: %s (%llu hits, %llu misses)\n",
+                hit ? "hit" : "miss", cache_entry, count[0], count[1]);
+}
+
+/* compute the cache entry name for a -run compile, or return -1 if the
+   inputs can't be cached (stdin, objects, libraries, @listfiles) */
+static int cache_init(TCCState *s, int argc0, char **argv0, char **argv)
+{
+    static const char *const env[] = { "C_INCLUDE_PATH", "CPATH", "LIBRARY_PATH" };
+    cache_hash h = CACHE_HASH_INIT;
+    struct stat st;
+    const char *v;
+    int i;
+
+    if (s->dflag & 16)
+        return -1;
+    if (argv <= argv0 || argv >= argv0 + argc0)
+        return -1;
+    for (i = 1; argv0 + i <= argv; i++) {
+        if (argv0[i][0] == '@')
+            return -1;
+        h = cache_hash_str(h, argv0[i]);
+    }
+    for (i = 0; i < s->nb_files; i++) {
+        struct filespec *f = s->files[i];
+        const char *ext = tcc_fileextension(f->name);
+        if ((f->type & AFF_TYPE_LIB) || !strcmp(f->name, "-")
+            || !strcmp(ext, ".o") || !strcmp(ext, ".a") || !strcmp(ext, ".so"))
+            return -1;
+        if (cache_hash_file(f->name, &st, &h))
+            return -1;
+    }
+    for (i = 0; i < countof(env); i++)
+        h = cache_hash_str(h, (v = getenv(env[i])) ? v : "");
+    h = cache_hash_str(h, TCC_VERSION);
+    h = cache_hash_stat(h, "/proc/self/exe");
+    h = cache_hash_stat(h, s->nostdlib ? "-" : "/lib/libc.a");
+
+    cache_dir_len = cache_get_dir(cache_entry, sizeof cache_entry - 32);
+    if (cache_dir_len <= 0 || cache_dir_len >= sizeof cache_entry - 32)
+        return -1;
+    snprintf(cache_entry + cache_dir_len, 32, "/%016llx", h);
+    return 0;
+}
+
+/* check the manifest of the current entry against the files on disk */
+static int cache_check(void)
+{
+    char path[sizeof cache_entry + 8], buf[1024];
+    unsigned long long size, mtime, hash;
+    struct stat st;
+    cache_hash h;
+    int ok = 0, len;
+    FILE *fp;
+
+    snprintf(path, sizeof path, "%s.deps", cache_entry);
+    fp = fopen(path, "re");
+    if (!fp)
+        return 0;
+    while (fscanf(fp, "%llu %llu %llx ", &size, &mtime, &hash) == 3
+           && fgets(buf, sizeof buf, fp)) {
+        len = strlen(buf);
+        if (len == 0 || buf[len - 1] != '\n')
+            goto done;
+        buf[len - 1] = 0;
+        if (stat(buf, &st) || st.st_size != size)
+            goto done;
+        if (cache_mtime(&st) != mtime) {
+            h = CACHE_HASH_INIT;
+            if (cache_hash_file(buf, &st, &h) || h != hash)
+                goto done;
+        }
+    }
+    ok = feof(fp);
+done:
+    fclose(fp);
+    return ok;
+}
+
+/* write the manifest for the current entry from the files tcc has read */
+static int cache_write_deps(TCCState *s, const char *tmp)
+{
+    unsigned long long mtime, now = time(NULL) * 1000000000ULL;
+    struct stat st;
+    cache_hash h;
+    FILE *fp;
+    int i;
+
+    fp = fopen(tmp, "we");
+    if (!fp)
+        return -1;
+    for (i = 0; i < s->nb_target_deps; i++) {
+        const char *dep = s->target_deps[i];
+        h = CACHE_HASH_INIT;
+        if (strchr(dep, '\n') || cache_hash_file(dep, &st, &h))
+            break;
+        /* a file modified just now may change again without its mtime
+           moving on, so record no mtime and always compare contents */
+        mtime = cache_mtime(&st);
+        if (mtime + 2000000000ULL > now)
+            mtime = 0;
+        fprintf(fp, "%llu %llu %016llx %s\n", (unsigned long long)st.st_size,
+                mtime, h, dep);
+    }
+    if (fclose(fp) || i < s->nb_target_deps)
+        return -1;
+    return 0;
+}
+
+/* link the program into the cache and exec it.  Returns 0 if the cache
+   is not writable and nothing was linked, or -1 if linking or exec failed. */
+static int cache_store(TCCState *s, char **argv)
+{
+    char exe[sizeof cache_entry + 16], deps[sizeof cache_entry + 16];
+    char final[sizeof cache_entry + 8];
+    int fd;
+
+    cache_entry[cache_dir_len] = 0;
+    if (cache_mkdirs(cache_entry) || access(cache_entry, W_OK))
+        return 0;
+    cache_entry[cache_dir_len] = '/';
+
+    snprintf(exe, sizeof exe, "%s.%d", cache_entry, getpid());
+    snprintf(deps, sizeof deps, "%s.deps.%d", cache_entry, getpid());
+    snprintf(final, sizeof final, "%s.deps", cache_entry);
+    if (tcc_output_file(s, exe)) {
+        unlink(exe);
+        return -1;
+    }
+    if (cache_write_deps(s, deps) == 0
+        && rename(deps, final) == 0
+        && rename(exe, cache_entry) == 0) {
+        cache_count(s, 0);
+        execve(cache_entry, argv, environ);
+        return -1;
+    }
+    /* the entry could not be stored, so run the program we linked anyway:
+       the state is already relocated and cannot be output a second time */
+    fd = open(exe, O_RDONLY | O_CLOEXEC);
+    unlink(exe);
+    unlink(deps);
+    if (fd >= 0)
+        fexecve(fd, argv, environ);
+    return -1;
+}
+
+/* libtcc1.a is linked into bootsh gzipped, and only inflated when the
+   linker first asks for it.  The inflated archive is shared with other
+   processes through the cache directory as libtcc1-<hash>.a. */
+int tcc_open_libtcc1a(TCCState *s1)
+{
+    static char *data;
+    char path[1024], tmp[1024 + 16];
+    struct stat st;
+    int fd, len;
+
+    len = cache_get_dir(path, sizeof path - 32);
+    if (len > 0 && len < sizeof path - 32) {
+        snprintf(path + len, 32, "/libtcc1-%016llx.a",
+                 cache_hash_mem(CACHE_HASH_INIT, libtcc1a_data, sizeof libtcc1a_data));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (fstat(fd, &st) == 0 && st.st_size == LIBTCC1A_LEN)
+                return fd;
+            close(fd);
+        }
+    }
+
+    if (!data) {
+        data = tcc_malloc(LIBTCC1A_LEN);
+        gunzip_mem(libtcc1a_data, sizeof libtcc1a_data, data, LIBTCC1A_LEN);
+    }
+
+    if (len > 0 && len < sizeof path - 32) {
+        path[len] = 0;
+        if (cache_mkdirs(path) == 0) {
+            path[len] = '/';
+            snprintf(tmp, sizeof tmp, "%s.%d", path, getpid());
+            fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd >= 0) {
+                int ok = write(fd, data, LIBTCC1A_LEN) == LIBTCC1A_LEN;
+                if (close(fd) == 0 && ok && rename(tmp, path) == 0)
+                    return open(path, O_RDONLY | O_CLOEXEC);
+                unlink(tmp);
+            }
+        }
+    }
+    return tcc_open_memfd(s1, "libtcc1a", data, LIBTCC1A_LEN);
+}
+
+/* cc -cache-clean, cc -cache-stats */
+static int cache_tool(const char *opt)
+{
+    char dir[sizeof cache_entry], path[sizeof cache_entry + 256];
+    unsigned long long count[2] = { 0, 0 }, bytes = 0;
+    unsigned entries = 0;
+    struct dirent *de;
+    struct stat st;
+    int clean = !strcmp(opt, "-cache-clean");
+    FILE *fp;
+    DIR *d;
+
+    if (cache_get_dir(dir, sizeof dir) <= 0) {
+        fprintf(stderr, "tcc: cache is disabled\n");
+        return 1;
+    }
+    snprintf(path, sizeof path, "%s/stats", dir);
+    if ((fp = fopen(path, "re"))) {
+        if (fscanf(fp, "%llu %llu", &count[0], &count[1]) != 2)
+            count[0] = count[1] = 0;
+        fclose(fp);
+    }
+    d = opendir(dir);
+    while (d && (de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof path, "%s/%s", dir, de->d_name);
+        if (lstat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+        if (strspn(de->d_name, "0123456789abcdef") == 16 && !de->d_name[16])
+            entries++;
+        bytes += st.st_size;
+        if (clean)
+            unlink(path);
+    }
+    if (d)
+        closedir(d);
+    printf("%s: %u entries, %llu bytes, %llu hits, %llu misses%s\n",
+           dir, entries, bytes, count[0], count[1], clean ? " removed" : "");
+    return 0;
+}
+
+int tcc_main(int argc0, char **argv0);
+
+/* index of the file a -j worker compiles, or -1 in the parent */
+static int cc_job = -1;
+
+/* copy a worker's buffered output to fd, then close it */
+static void replay(int from, int fd)
+{
+    char buf[4096];
+    ssize_t len;
+
+    lseek(from, 0, SEEK_SET);
+    while ((len = read(from, buf, sizeof buf)) > 0)
+        if (write(fd, buf, len) != len)
+            break;
+    close(from);
+}
+
+/* cc -c with many files: compile each in a worker process, up to jobs at a
+   time, and print their output in command line order as they finish.  A
+   finished job holds its output fds until it is printed, so no more than
+   jobs are started ahead of the oldest one not yet printed. */
+static int compile_jobs(TCCState *s1, int argc0, char **argv0, int jobs)
+{
+    struct { pid_t pid; int status, out, err; } *job;
+    int nb_files = s1->nb_files, started = 0, printed = 0, ret = 0;
+    int i, status;
+    pid_t pid;
+
+    job = tcc_mallocz(nb_files * sizeof *job);
+    while (printed < nb_files) {
+        for (; started - printed < jobs && started < nb_files; ++started) {
+            job[started].out = tcc_open_memfd(s1, "cc-out", "", 0);
+            job[started].err = tcc_open_memfd(s1, "cc-err", "", 0);
+            fflush(stdout);
+            fflush(stderr);
+            pid = fork();
+            if (pid == 0) {
+                dup2(job[started].out, 1);
+                dup2(job[started].err, 2);
+                cc_job = started;
+                exit(tcc_main(argc0, argv0));
+            }
+            if (pid < 0) {
+                tcc_error_noabort("fork failed");
+                exit(1);
+            }
+            job[started].pid = pid;
+        }
+        pid = wait(&status);
+        for (i = printed; i < started; ++i) {
+            if (job[i].pid == pid) {
+                job[i].pid = 0;
+                job[i].status = status;
+            }
+        }
+        for (; printed < started && !job[printed].pid; ++printed) {
+            replay(job[printed].out, 1);
+            replay(job[printed].err, 2);
+            status = job[printed].status;
+            if (!WIFEXITED(status) || WEXITSTATUS(status))
+                ret = 1;
+        }
+    }
+    tcc_free(job);
+    tcc_delete(s1);
+    return ret;
+}
+
 int tcc_main(int argc0, char **argv0)
 {
     TCCState *s, *s1;
-    int ret, opt, n = 0, t = 0, done, tcc_run;
-    unsigned start_time = 0, end_time = 0;
+    int ret, opt, n = 0, t = 0, done, tcc_run, cached = 0;
+    unsigned start_time = 0, compile_time = 0, link_time = 0, now;
     const char *first_file;
     int argc; char **argv;
     FILE *ppfp = stdout;
 
+    if (argc0 == 2 && (!strcmp(argv0[1], "-cache-clean") || !strcmp(argv0[1], "-cache-stats")))
+        return cache_tool(argv0[1]);
+    if (cc_job >= 0)
+        n = cc_job;
+
 redo:
     argc = argc0, argv = argv0;
     s = s1 = tcc_new();
@@ -250,8 +681,25 @@ redo:
         }
         if (s->nb_errors)
             return 1;
+        if (s->output_type == TCC_OUTPUT_OBJ && !s->option_r && s->nb_files > 1
+            && !s->do_bench && cc_job < 0) {
+            int jobs = s->nb_jobs;
+            if (!jobs)
+                jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (jobs > 1)
+                return compile_jobs(s, argc0, argv0, jobs);
+        }
         if (s->do_bench)
             start_time = getclock_ms();
+        if (tcc_run && cache_init(s, argc0, argv0, argv) == 0) {
+            if (cache_check() && access(cache_entry, X_OK) == 0) {
+                cache_count(s, 1);
+                execve(cache_entry, argv, environ);
+            }
+            /* record every header for the manifest */
+            s->gen_deps = s->include_sys_deps = 1;
+            cached = 1;
+        }
     }
 
     set_environment(s);
@@ -287,6 +735,13 @@ redo:
         done = ret || ++n >= s->nb_files;
     } while (!done && (s->output_type != TCC_OUTPUT_OBJ || s->option_r));
 
+    /* everything from here on, including libc, counts as link time */
+    if (s->do_bench) {
+        now = getclock_ms();
+        compile_time += now - start_time;
+        start_time = now;
+    }
+
     while (s->new_undef_sym) {
         s->new_undef_sym = 0;
         if (!s->nostdlib) ld_add_file(s, "/lib/libc.a");
@@ -308,31 +763,32 @@ redo:
         }
     }
 
-    if (s->do_bench)
-        end_time = getclock_ms();
-
     if (s->run_test) {
         t = 0;
     } else if (s->output_type == TCC_OUTPUT_PREPROCESS) {
         ;
     } else if (0 == ret) {
         if (tcc_run) {
-            int fd = memfd_create("tccrun", MFD_CLOEXEC);
-            s->outfile = tcc_malloc(32);
-            if (fd < 0) {
-                strcpy(s->outfile, "/tmp/tccrun-XXXXXX");
-                fd = mkstemp(s->outfile);
+            if (cached && cache_store(s, argv)) {
+                ret = 1;
+            } else {
+                int fd = memfd_create("tccrun", MFD_CLOEXEC);
+                s->outfile = tcc_malloc(32);
                 if (fd < 0) {
-                    tcc_error_noabort("could not create temporary file");
-                    exit(1);
+                    strcpy(s->outfile, "/tmp/tccrun-XXXXXX");
+                    fd = mkstemp(s->outfile);
+                    if (fd < 0) {
+                        tcc_error_noabort("could not create temporary file");
+                        exit(1);
+                    }
+                    tcc_output_file(s, s->outfile);
+                    close(fd);
+                    execve(s->outfile, argv, environ);
                 }
+                snprintf(s->outfile, 32, "/proc/%d/fd/%d", getpid(), fd);
                 tcc_output_file(s, s->outfile);
-                close(fd);
-                execve(s->outfile, argv, environ);
+                fexecve(fd, argv, environ);
             }
-            snprintf(s->outfile, 32, "/proc/%d/fd/%d", getpid(), fd);
-            tcc_output_file(s, s->outfile);
-            fexecve(fd, argv, environ);
         } else {
             if (!s->outfile)
                 s->outfile = default_outputfile(s, first_file);
@@ -343,15 +799,23 @@ redo:
         }
     }
 
+    if (s->do_bench) {
+        now = getclock_ms();
+        link_time += now - start_time;
+        start_time = now;
+    }
+
     done = 1;
     if (t)
         done = 0; /* run more tests with -dt -run */
     else if (s->nb_errors)
         ret = 1;
-    else if (n < s->nb_files)
+    else if (n < s->nb_files && cc_job < 0)
         done = 0; /* compile more files with -c */
-    else if (s->do_bench)
-        tcc_print_stats(s, end_time - start_time);
+    else if (s->do_bench) {
+        tcc_print_stats(s, compile_time);
+        fprintf(stderr, "# link %0.3f s\n", (double)link_time/1000);
+    }
     tcc_delete(s);
     if (!done)
         goto redo;
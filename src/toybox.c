@@ -4,6 +4,7 @@
  */
 
 #include "../lib/toybox/toys.h"
+#include "dispatch.h"
 
 // Populate toy_list[].
 
@@ -25,26 +26,17 @@ char *toybox_version = TOYBOX_VERSION, toybuf[4096], libbuf[4096];
 
 struct toy_list *toy_find(char *name)
 {
-  int top, bottom, middle;
+  const struct dispatch *dp;
 
   if (!CFG_TOYBOX || strchr(name, '/')) return 0;
 
   // Multiplexer name works as prefix, else skip first entry (it's out of order)
   if (!toys.which && strstart(&name, toy_list->name)) return toy_list;
-  bottom = 1;
-
-  // Binary search to find this command.
-  top = ARRAY_LEN(toy_list)-1;
-  for (;;) {
-    int result;
-
-    middle = (top+bottom)/2;
-    if (middle<bottom || middle>top) return 0;
-    result = strcmp(name,toy_list[middle].name);
-    if (!result) return toy_list+middle;
-    if (result<0) top = --middle;
-    else bottom = ++middle;
-  }
+
+  // The build-time perfect hash of every command name in the binary.
+  dp = finddispatch(name);
+
+  return (dp && dp->toy > 0) ? toy_list+dp->toy : 0;
 }
 
 // Figure out whether or not anything is using the option parsing logic,
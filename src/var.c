@@ -63,7 +63,7 @@
 #include "system.h"
 
 
-#define VTABSIZE 39
+#define VTABSIZE 64		/* initial size, a power of two */
 
 
 struct localvar_list {
@@ -77,6 +77,7 @@ const char defpathvar[] =
 	"PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
 char defifsvar[] = "IFS= \t\n";
 MKINIT char defoptindvar[] = "OPTIND=1";
+MKINIT int envpwd;		/* PWD was in the environment we started with */
 
 int lineno;
 char linenovar[sizeof("LINENO=")+sizeof(int)*CHAR_BIT/3+1] = "LINENO=";
@@ -84,30 +85,44 @@ char linenovar[sizeof("LINENO=")+sizeof(int)*CHAR_BIT/3+1] = "LINENO=";
 /* Some macros in var.h depend on the order, add new variables to the end. */
 struct var varinit[] = {
 #if ATTY
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"ATTY\0",	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"ATTY\0",	0,	0 },
 #endif
-	{ 0,	VSTRFIXED|VTEXTFIXED,		defifsvar,	0 },
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAIL\0",	changemail },
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAILPATH\0",	changemail },
-	{ 0,	VSTRFIXED|VTEXTFIXED,		defpathvar,	changepath },
-	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS1=$ ",	0 },
-	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS2=> ",	0 },
-	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS4=+ ",	0 },
-	{ 0,	VSTRFIXED|VTEXTFIXED,		defoptindvar,	getoptsreset },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		defifsvar,	0,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAIL\0",	changemail,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"MAILPATH\0",	changemail,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		defpathvar,	changepath,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS1=$ ",	0,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS2=> ",	0,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		"PS4=+ ",	0,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		defoptindvar,	getoptsreset,	0 },
 #ifdef WITH_LINENO
-	{ 0,	VSTRFIXED|VTEXTFIXED,		linenovar,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED,		linenovar,	0,	0 },
 #endif
 #ifndef SMALL
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TERM\0",	0 },
-	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"HISTSIZE\0",	sethistsize },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"TERM\0",	0,	0 },
+	{ 0,	VSTRFIXED|VTEXTFIXED|VUNSET,	"HISTSIZE\0",	sethistsize,	0 },
 #endif
 };
 
-STATIC struct var *vartab[VTABSIZE];
+STATIC struct var *vartab0[VTABSIZE];
+STATIC struct var **vartab = vartab0;
+STATIC unsigned vtabsize = VTABSIZE;
+STATIC unsigned nvars;
+
+/*
+ * The environment for new programs: the entries the shell could not
+ * import as variables, and the exported variables.  It is kept up to
+ * date as variables change, each exported variable knowing its slot.
+ */
+STATIC char **envcache;
+STATIC struct var **envvars;	/* owner of each slot, NULL if imported */
+STATIC unsigned envlen, envsize;
 
 STATIC struct var **hashvar(const char *);
+STATIC void growvartab(void);
 STATIC int vpcmp(const void *, const void *);
 STATIC struct var **findvar(const char *);
+STATIC void envupdate(struct var *);
 
 /*
  * Initialize the varable symbol tables and import the environment
@@ -132,7 +147,8 @@ INIT {
 		p = endofname(*envp);
 		if (p != *envp && *p == '=') {
 			setvareq(*envp, VEXPORT|VTEXTFIXED);
-		}
+		} else
+			envadd(*envp, NULL);
 	}
 
 	setvareq(defifsvar, VTEXTFIXED);
@@ -142,6 +158,7 @@ INIT {
 	setvareq(ppid, VTEXTFIXED);
 
 	p = lookupvar("PWD");
+	envpwd = !!p;
 	if (p)
 		if (*p != '/' || stat64(p, &st1) || stat64(".", &st2) ||
 		    st1.st_dev != st2.st_dev || st1.st_ino != st2.st_ino)
@@ -177,6 +194,7 @@ initvar(void)
 		vpp = hashvar(vp->text);
 		vp->next = *vpp;
 		*vpp = vp;
+		nvars++;
 	} while (++vp < end);
 	/*
 	 * PS1 depends on uid
@@ -252,6 +270,8 @@ struct var *setvareq(char *s, int flags)
 	struct var *vp, **vpp;
 
 	flags |= (VEXPORT & (((unsigned) (1 - aflag)) - 1));
+	if (nvars >= vtabsize)
+		growvartab();
 	vpp = findvar(s);
 	vp = *vpp;
 	if (vp) {
@@ -279,7 +299,10 @@ struct var *setvareq(char *s, int flags)
 			bits = VSTRFIXED;
 		else {
 			*vpp = vp->next;
+			vp->flags = VUNSET;
+			envupdate(vp);
 			ckfree(vp);
+			nvars--;
 out_free:
 			if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 				ckfree(s);
@@ -294,12 +317,15 @@ out_free:
 		vp = ckmalloc(sizeof (*vp));
 		vp->next = *vpp;
 		vp->func = NULL;
+		vp->envidx = 0;
 		*vpp = vp;
+		nvars++;
 	}
 	if (!(flags & (VTEXTFIXED|VSTACK|VNOSAVE)))
 		s = savestr(s);
 	vp->text = s;
 	vp->flags = flags;
+	envupdate(vp);
 
 out:
 	return vp;
@@ -354,7 +380,7 @@ listvars(int on, int off, char ***end)
 					ep = growstackstr();
 				*ep++ = (char *) vp->text;
 			}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 	if (ep == stackstrend())
 		ep = growstackstr();
 	if (end)
@@ -364,6 +390,92 @@ listvars(int on, int off, char ***end)
 }
 
 
+/*
+ * Return the environment for a new program.
+ */
+
+char **
+environment(void)
+{
+	if (!envcache)
+		envadd(NULL, NULL);
+	return envcache;
+}
+
+
+/*
+ * Return the environment for a command built into the binary, in the
+ * forked child that runs it.  These commands never saw a PWD the shell
+ * exported itself, and toybox's env tests depend on that, so drop it.
+ */
+
+char **
+binaryenvironment(void)
+{
+	struct var *vp;
+
+	if (!envpwd && (vp = *findvar("PWD"))) {
+		vp->flags &= ~VEXPORT;
+		envupdate(vp);
+	}
+	return environment();
+}
+
+
+/*
+ * Add an entry to the environment.
+ */
+
+void
+envadd(char *text, struct var *vp)
+{
+	INTOFF;
+	if (envlen + 2 > envsize) {
+		envsize = envsize ? envsize * 2 : 64;
+		envcache = ckrealloc(envcache, envsize * sizeof(*envcache));
+		envvars = ckrealloc(envvars, envsize * sizeof(*envvars));
+	}
+	if (text) {
+		envvars[envlen] = vp;
+		envcache[envlen++] = text;
+		if (vp)
+			vp->envidx = envlen;
+	}
+	envcache[envlen] = NULL;
+	INTON;
+}
+
+
+/*
+ * Bring a variable's environment entry up to date after it was set,
+ * unset, exported or freed.  A removed entry is replaced by the last.
+ */
+
+STATIC void
+envupdate(struct var *vp)
+{
+	unsigned i = vp->envidx;
+
+	if ((vp->flags & (VEXPORT|VUNSET)) == VEXPORT) {
+		if (i)
+			envcache[i - 1] = (char *)vp->text;
+		else
+			envadd((char *)vp->text, vp);
+		return;
+	}
+	if (!i)
+		return;
+	vp->envidx = 0;
+	if (i != envlen) {
+		envcache[i - 1] = envcache[envlen - 1];
+		envvars[i - 1] = envvars[envlen - 1];
+		if (envvars[i - 1])
+			envvars[i - 1]->envidx = i;
+	}
+	envcache[--envlen] = NULL;
+}
+
+
 
 /*
  * POSIX requires that 'set' (but not export or readonly) output the
@@ -423,6 +535,7 @@ exportcmd(int argc, char **argv)
 			} else {
 				if ((vp = *findvar(name))) {
 					vp->flags |= flag;
+					envupdate(vp);
 					continue;
 				}
 			}
@@ -537,6 +650,7 @@ poplocalvars(void)
 				ckfree(vp->text);
 			vp->flags = lvp->flags;
 			vp->text = lvp->text;
+			envupdate(vp);
 		}
 		ckfree(lvp);
 	}
@@ -624,10 +738,43 @@ hashvar(const char *p)
 {
 	unsigned int hashval;
 
-	hashval = ((unsigned char) *p) << 4;
+	/* FNV-1a */
+	hashval = 2166136261u;
 	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+		hashval = (hashval ^ (unsigned char) *p++) * 16777619;
+	return &vartab[hashval & (vtabsize - 1)];
+}
+
+
+/*
+ * Double the size of the hash table once it holds as many variables
+ * as it has slots.
+ */
+
+STATIC void
+growvartab(void)
+{
+	struct var **old, **vpp;
+	struct var *vp, *next;
+	unsigned oldsize, i;
+
+	INTOFF;
+	old = vartab;
+	oldsize = vtabsize;
+	vtabsize <<= 1;
+	vartab = ckmalloc(vtabsize * sizeof(*vartab));
+	memset(vartab, 0, vtabsize * sizeof(*vartab));
+	for (i = 0; i < oldsize; i++) {
+		for (vp = old[i]; vp; vp = next) {
+			next = vp->next;
+			vpp = hashvar(vp->text);
+			vp->next = *vpp;
+			*vpp = vp;
+		}
+	}
+	if (old != vartab0)
+		ckfree(old);
+	INTON;
 }
 
 
@@ -59,6 +59,7 @@ struct var {
 	void (*func)(const char *);
 					/* function to be called when  */
 					/* the variable gets set/unset */
+	unsigned envidx;		/* slot in environment() + 1 */
 };
 
 
@@ -142,7 +143,9 @@ struct strlist;
 char *lookupvar(const char *);
 intmax_t lookupvarint(const char *);
 char **listvars(int, int, char ***);
-#define environment() listvars(VEXPORT, VUNSET, 0)
+char **environment(void);
+char **binaryenvironment(void);
+void envadd(char *, struct var *);
 int showvars(const char *, int, int);
 int exportcmd(int, char **);
 int localcmd(int, char **);